@@ -11,6 +11,18 @@
 
 #include <linux/types.h>
 #include <linux/i2c.h>
+#include <linux/regmap.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+
+#include <bme280_uapi.h>
+#include <bme280_stats.h>
+
+struct iio_dev;
 
 /** Success code */
 #define BME280_OK 0
@@ -21,6 +33,7 @@
 #define BME280_E_COMM_FAIL -3
 #define BME280_E_SLEEP_MODE_FAIL -4
 #define BME280_E_NVM_COPY_FAILED -5
+#define BME280_E_MEAS_TIMEOUT -6
 
 /** Warning codes */
 #define BME280_W_INVALID_OSRS_MACRO 1
@@ -42,11 +55,13 @@
 #define BME280_CTRL_MEAS_ADDR 0xF4
 #define BME280_CTRL_HUM_ADDR 0xF2
 #define BME280_DATA_ADDR 0xF7
+#define BME280_SNAPSHOT_ADDR 0xF2
 
 /** Macros related to size */
 #define BME280_TEMP_PRESS_CALIB_DATA_LEN 26
 #define BME280_HUM_CALIB_DATA_LEN 7
 #define BME280_PRESS_TEMP_HUM_DATA_LEN 8
+#define BME280_SNAPSHOT_LEN 13
 
 /** Sensor component selection macros */
 #define BME280_PRESS 1
@@ -92,6 +107,17 @@
 #define BME280_STANDBY_TIME_10_MS 0x06
 #define BME280_STANDBY_TIME_20_MS 0x07
 
+/** Measurement time (Appendix B from datasheet), in microseconds */
+#define BME280_MEAS_OFFSET_US 1250
+#define BME280_MEAS_DUR_US 2300
+#define BME280_PRESS_HUM_MEAS_OFFSET_US 575
+
+/** Upper bound for a single conversion, all channels at 16x take ~113 ms */
+#define BME280_MEAS_TIMEOUT_US 250000
+
+/** Pressure, temperature, humidity and measurements attributes */
+#define BME280_NOTIFY_ATTRS 4
+
 #define BME280_SOFT_RESET_COMMAND 0xB6
 #define BME280_STATUS_IM_UPDATE 0x01
 
@@ -109,9 +135,29 @@
 #define BME280_GAMING_FILTER_COEFF BME280_FILTER_COEFF_16
 #define BME280_GAMING_STANDBY_TIME BME280_STANDBY_TIME_0_5_MS
 
+/** Precision of pressure compensation */
+#define BME280_PRESS_PRECISION_32 32 /**< 32-bit formula, whole Pa */
+#define BME280_PRESS_PRECISION_64 64 /**< 64-bit formula, Pa / 256 */
+
 /** Macro to combine two 8 bit data's to form a 16 bit data */
 #define bme280_concat_bytes(msb, lsb) ((u16)msb << 8) | (u16)lsb
 
+/**
+ * @brief Products of calibration values used by compensation, which don't
+ * depend on measurements and are derived once when calibration data is read
+ */
+struct bme280_comp_context {
+	s32 t1; /**< dig_T1 */
+	s32 t1_x2; /**< dig_T1 * 2 */
+	s32 p4_x65536; /**< dig_P4 * 65536 */
+	s32 p5_x2; /**< dig_P5 * 2 */
+	s32 h4_offset; /**< 16384 - dig_H4 * 1048576, rounding of the first
+		humidity term included */
+	s64 p4_x2_35; /**< dig_P4 * 2^35 of the 64-bit pressure formula */
+	u8 press_precision; /**< BME280_PRESS_PRECISION_64 selects the 64-bit
+		pressure formula, any other value the 32-bit one */
+};
+
 struct bme280_calib_data {
 	u16 dig_T1; /**< Temperature compensation value */
 	s16 dig_T2; /**< Temperature compensation value */
@@ -134,15 +180,16 @@ struct bme280_calib_data {
 	s16 dig_H5; /**< Humidity compensation value */
 	s8 dig_H6; /**< Humidity compensation value */
 
-	s32 t_fine; /**< Temperature with high resolution, stored as an
-		attribute as this is used for temperature compensation reading
-		humidity and pressure */
+	struct bme280_comp_context context; /**< Derived compensation values */
 };
 
 struct bme280_data {
 	u32 pressure; /**< Compensated pressure,
 		- Pa = compensated pressure,
 		- mm Hg = compensated pressure / 133.3224 */
+	u32 pressure_fine; /**< Compensated pressure with fraction, 8 bits of
+		it are meaningful only with the 64-bit formula,
+		- Pa = compensated pressure / 256 */
 	s32 temperature; /**< Compensated temperature,
 		- °C = compensated temperature / 100 */
 	u32 humidity; /**< Compensated humidity,
@@ -163,13 +210,83 @@ struct bme280_settings {
 	u8 standby_time; /**< Standby time */
 };
 
+/**
+ * @brief Settings, status and data registers (0xF2 to 0xFE) read by a single
+ * burst transfer
+ */
+struct bme280_snapshot {
+	u8 mode; /**< Sensor power mode */
+	u8 status; /**< Status register, see bme280_status */
+	struct bme280_settings settings; /**< Sensor settings */
+	struct bme280_uncomp_data uncomp_data; /**< Uncompensated data */
+};
+
+struct bme280_sample {
+	u64 timestamp; /**< Monotonic time of the sample in nanoseconds, zero
+		when there is no sample yet */
+	struct bme280_uncomp_data uncomp_data; /**< Uncompensated data */
+	struct bme280_data comp_data; /**< Compensated data */
+};
+
 struct bme280 {
+	struct mutex lock; /**< Serializes bus access, conversions and state of
+		the device, taken after bme280_devices_lock if both are needed */
+	u64 locked; /**< Monotonic time lock was acquired at, protected by
+		lock */
+	enum bme280_entry locked_entry; /**< Entry point holding lock,
+		protected by lock */
+	struct kref refs; /**< References of registry, open files and current
+		selected device readers */
+	bool removed; /**< Device is unregistered and must not be accessed */
 	u8 chip_id; /**< Chip Id */
 	struct i2c_client *client; /**< I2C interface */
+	struct i2c_adapter *adapter; /**< Adapter of the client, compared
+		without lock to group devices of the same bus */
+	struct regmap *regmap; /**< Register map on top of I2C interface, caches
+		settings registers */
 	struct bme280_settings settings; /**< Sensor settings */
 	struct bme280_calib_data calib_data; /**< Calibration data */
-	struct list_head registered; /**< Linked list node to hold registered
-		devices */
+	u32 soft_resets; /**< Number of soft resets issued to the device, the
+		measurement path never resets the device */
+	u32 cache_hits; /**< Number of register reads served from cache */
+	u32 cache_misses; /**< Number of cacheable register reads served from
+		the device */
+	struct bme280_stats *stats; /**< Statistics of bus, conversions and
+		entry points, updated without lock. Allocated apart from the
+		device, they take tens of kilobytes */
+	struct dentry *debugfs; /**< Directory in debugfs */
+	struct delayed_work sampler; /**< Periodic work of normal mode sampler */
+	bool sampling; /**< Device is sampled in normal mode */
+	struct bme280_sample sample; /**< Latest sample of normal mode sampler
+		or forced conversion, protected by lock */
+	u8 sample_comp; /**< Channels compensated in the latest sample */
+	u32 conversions; /**< Number of forced conversions of requests */
+	u32 coalesced; /**< Number of requests served by a conversion which was
+		in flight when they arrived */
+	bool converting; /**< Forced conversion is started and its result is not
+		collected yet, cleared by soft reset and sleep */
+	u64 triggered; /**< Monotonic time of the last forced conversion start
+		in nanoseconds */
+	u32 pipeline; /**< Staleness bound of pipelined forced conversions in
+		milliseconds, zero disables pipelining */
+	DECLARE_KFIFO_PTR(ring, struct bme280_record); /**< Ring of samples
+		produced by sampler, protected by lock */
+	u32 sequence; /**< Sequence number of the next sample */
+	u32 dropped; /**< Number of samples dropped on ring overflow */
+	u32 watermark; /**< Number of samples in ring which wakes up readers */
+	wait_queue_head_t samples_wait; /**< Readers of ring of samples wait
+		here */
+	atomic_t samples_generation; /**< Changes every time the ring reaches
+		its watermark, the sampler stops or the device is removed */
+	dev_t devt; /**< Number of character device */
+	struct cdev *cdev; /**< Character device to read ring of samples */
+	struct device *chardev; /**< Character device in class bme280 */
+	struct kernfs_node *notify_kn[BME280_NOTIFY_ATTRS]; /**< Attributes
+		of character device notified about new samples, protected by
+		lock */
+	struct iio_dev *iio; /**< Device in Industrial I/O subsystem */
+	struct list_head registered; /**< RCU protected linked list node to
+		hold registered devices */
 };
 
 /**
@@ -253,6 +370,25 @@ union bme280_ctrl_meas {
  */
 ssize_t bme280_init(struct bme280 *self, struct i2c_client *client);
 
+/**
+ * @brief Releases resources acquired by bme280_init
+ *
+ * @param[in] self : Structure instance of bme280
+ */
+void bme280_deinit(struct bme280 *self);
+
+/**
+ * @brief Checks whether the register is volatile (not cached). Settings
+ * registers are cached, status, data and ctrl_meas registers are volatile,
+ * because the device clears the power mode in ctrl_meas after a forced
+ * measurement
+ *
+ * @param[in] reg_addr : Register address
+ *
+ * @return One if the register is volatile, zero otherwise
+ */
+bool bme280_is_volatile_reg(u8 reg_addr);
+
 /**
  * @brief Reads the data from the given register address of the sensor
  *
@@ -264,11 +400,13 @@ ssize_t bme280_init(struct bme280 *self, struct i2c_client *client);
  * @return Result of execution
  * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
  */
-ssize_t bme280_get_regs(const struct bme280 *self, u8 reg_addr, u8 *reg_data,
+ssize_t bme280_get_regs(struct bme280 *self, u8 reg_addr, u8 *reg_data,
 			u8 len);
 
 /**
- * @brief Writes the given data to the register address of the sensor
+ * @brief Writes the given data to the register address of the sensor.
+ * Registers are written with a single bus transaction when the I2C adapter
+ * supports plain I2C messages, and one by one via SMBus otherwise
  *
  * @param[in] self : Structure instance of bme280
  * @param[in] reg_addr : Register address from where the data to be written
@@ -279,9 +417,40 @@ ssize_t bme280_get_regs(const struct bme280 *self, u8 reg_addr, u8 *reg_data,
  * @return Result of execution
  * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
  */
-ssize_t bme280_set_regs(const struct bme280 *self, u8 *reg_addr,
+ssize_t bme280_set_regs(struct bme280 *self, u8 *reg_addr,
 			const u8 *reg_data, u8 len);
 
+/**
+ * @brief Reads settings, status and data registers of the sensor by a single
+ * block transfer. The transfer bypasses the register cache, so the snapshot
+ * always reflects the device state
+ *
+ * @param[in] self : Structure instance of bme280
+ * @param[out] snapshot : Structure instance of bme280_snapshot
+ *
+ * @return Result of execution
+ * @retval zero -> Success / -ve value -> Error
+ */
+ssize_t bme280_get_snapshot(struct bme280 *self,
+			    struct bme280_snapshot *snapshot);
+
+/**
+ * @brief Reads snapshots of several sensors on the same I2C adapter by a single
+ * I2C transfer, a register address write and a block read per device. The
+ * adapter is locked once for the whole transfer. Requires plain I2C messages
+ * support of the adapter
+ *
+ * @param[in] devices : Structure instances of bme280 on the same adapter
+ * @param[in] count : Number of devices
+ * @param[out] snapshots : Structure instances of bme280_snapshot, one per
+ * device
+ *
+ * @return Result of execution
+ * @retval zero -> Success / -ve value -> Error
+ */
+ssize_t bme280_get_snapshots(struct bme280 **devices, u8 count,
+			     struct bme280_snapshot *snapshots);
+
 /**
  * @brief Gets the oversampling, filter and standby duration (normal mode)
  * settings from the sensor
@@ -316,8 +485,7 @@ ssize_t bme280_get_sensor_settings(struct bme280 *self);
  * @return Result of execution
  * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
  */
-ssize_t bme280_set_sensor_settings(const struct bme280 *self,
-				   u8 desired_settings);
+ssize_t bme280_set_sensor_settings(struct bme280 *self, u8 desired_settings);
 
 /**
  * @brief Gets the power mode of the sensor
@@ -334,7 +502,7 @@ ssize_t bme280_set_sensor_settings(const struct bme280 *self,
  * @return Result of execution
  * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
  */
-ssize_t bme280_get_sensor_mode(const struct bme280 *self, u8 *sensor_mode);
+ssize_t bme280_get_sensor_mode(struct bme280 *self, u8 *sensor_mode);
 
 /**
  * @brief Sets the power mode of the sensor
@@ -351,7 +519,41 @@ ssize_t bme280_get_sensor_mode(const struct bme280 *self, u8 *sensor_mode);
  * @return Result of execution
  * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
  */
-ssize_t bme280_set_sensor_mode(const struct bme280 *self, u8 sensor_mode);
+ssize_t bme280_set_sensor_mode(struct bme280 *self, u8 sensor_mode);
+
+/**
+ * @brief Starts a single measurement in forced mode. Unlike
+ * bme280_set_sensor_mode, the device is never reset: the power mode bits of
+ * ctrl_meas are rewritten in place, so the oversampling settings are kept and
+ * the sensor moves from sleep or normal mode to forced mode with a single
+ * register write
+ *
+ * @param[in] self : Structure instance of bme280
+ *
+ * @return Result of execution
+ * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
+ */
+ssize_t bme280_trigger_forced_mode(struct bme280 *self);
+
+/**
+ * @brief Calculates the maximum measurement time for the given oversampling
+ * settings, according to Appendix B from datasheet
+ *
+ * @param[in] settings : Sensor settings
+ *
+ * @return Measurement time in microseconds
+ */
+u32 bme280_calc_meas_time(const struct bme280_settings *settings);
+
+/**
+ * @brief Calculates the inactive duration between measurements in normal
+ * mode for the given standby time setting
+ *
+ * @param[in] settings : Sensor settings
+ *
+ * @return Standby time in microseconds
+ */
+u32 bme280_calc_standby_time(const struct bme280_settings *settings);
 
 /**
  * @brief Performs the soft reset of the sensor
@@ -361,7 +563,7 @@ ssize_t bme280_set_sensor_mode(const struct bme280 *self, u8 sensor_mode);
  * @return Result of execution
  * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
  */
-ssize_t bme280_soft_reset(const struct bme280 *self);
+ssize_t bme280_soft_reset(struct bme280 *self);
 
 /**
  * @brief Reads the pressure, temperature and humidity data from the sensor,
@@ -387,9 +589,42 @@ ssize_t bme280_soft_reset(const struct bme280 *self);
 ssize_t bme280_get_sensor_data(struct bme280 *self, u8 sensor_comp,
 			       struct bme280_data *comp_data);
 
+/**
+ * @brief Triggers a forced measurement and waits for its end, snapshot
+ * holds the uncompensated data of the measurement
+ *
+ * @param[in] self : Structure instance of bme280
+ * @param[out] snapshot : Structure instance of bme280_snapshot
+ *
+ * @return Result of execution
+ * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
+ */
+ssize_t bme280_get_snapshot_forced(struct bme280 *self,
+				   struct bme280_snapshot *snapshot);
+
+/**
+ * @brief Waits for the end of a forced measurement started by
+ * bme280_trigger_forced_mode, snapshot holds the uncompensated data of the
+ * measurement. Only the rest of the measurement time is slept, so several
+ * devices triggered back to back convert in parallel
+ *
+ * @param[in] self : Structure instance of bme280
+ * @param[in] triggered : Monotonic time of the trigger in nanoseconds
+ * @param[out] snapshot : Structure instance of bme280_snapshot
+ *
+ * @return Result of execution
+ * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
+ */
+ssize_t bme280_get_snapshot_triggered(struct bme280 *self, u64 triggered,
+				      struct bme280_snapshot *snapshot);
+
 /**
  * @brief Same as bme280_get_sensor_data but set forced power mode before
- * get sensor data. Put device to sleep after measuring
+ * get sensor data. Device returns to sleep by itself after measuring
+ *
+ * Sleeps for the measurement time of the current settings and confirms the
+ * end of conversion with a status read. Returns BME280_E_MEAS_TIMEOUT if the
+ * conversion doesn't finish within BME280_MEAS_TIMEOUT_US
  *
  * @param[in] self : Structure instance of bme280
  * @param[in] sensor_comp : Variable which selects which data to be read from
@@ -423,7 +658,8 @@ void bme280_parse_sensor_data(const u8 *reg_data,
 
 /**
  * @brief Compensates the pressure and/or temperature and/or humidity data
- * according to the component selected by the user
+ * according to the component selected by the user. It only reads calibration
+ * data, so it needs no lock and may run for many samples in parallel
  *
  * @param[in] sensor_comp : Used to select pressure and/or temperature and/or
  * humidity
@@ -439,6 +675,6 @@ void bme280_parse_sensor_data(const u8 *reg_data,
 ssize_t bme280_compensate_data(u8 sensor_comp,
 			       const struct bme280_uncomp_data *uncomp_data,
 			       struct bme280_data *comp_data,
-			       struct bme280_calib_data *calib_data);
+			       const struct bme280_calib_data *calib_data);
 
 #endif /* _BME280_H */
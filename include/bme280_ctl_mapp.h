@@ -0,0 +1,31 @@
+/**
+ * @brief Bosch Sensortec's BME280 control device of all registered devices
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#ifndef _BME280_CTL_MAPP_H
+#define _BME280_CTL_MAPP_H
+
+#include <bme280.h>
+
+/**
+ * @brief Creates the control device, which reads many devices by a single
+ * system call. Conversions of all selected devices are started back to back
+ * and collected afterwards, so they run in parallel
+ *
+ *   Mapping      |  Operations
+ * ---------------|-----------------------------
+ *   /dev/bme280  |  ioctl(BME280_IOC_BATCH_READ)
+ *
+ * @return Result of execution
+ */
+ssize_t bme280_create_ctl_mapp(void);
+
+/**
+ * @brief Removes the control device
+ */
+void bme280_remove_ctl_mapp(void);
+
+#endif /* _BME280_CTL_MAPP_H */
@@ -0,0 +1,60 @@
+/**
+ * @brief Bosch Sensortec's BME280 debugging information mapping in debugfs
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#ifndef _BME280_DEBUG_MAPP_H
+#define _BME280_DEBUG_MAPP_H
+
+#include <bme280.h>
+
+/**
+ * @brief Creates the root directory of debugging information in debugfs.
+ * Debugfs is optional, so failures are reported but not returned. Wait and
+ * hold times of the registry lock are accounted by entry points, a write
+ * resets them
+ *
+ *   Mapping                                 |  Operations
+ * ------------------------------------------|--------------
+ *   /sys/kernel/debug/bme280                |  directory
+ *   /sys/kernel/debug/bme280/devices_lock   |  read, write
+ */
+void bme280_create_debug_mapp(void);
+
+/**
+ * @brief Removes the root directory of debugging information in debugfs with
+ * all device directories
+ */
+void bme280_remove_debug_mapp(void);
+
+/**
+ * @brief Creates the debugging information mapping of the device, directory
+ * is named after the I2C client (adapter number and address). Statistics hold
+ * bus, error and conversion counters, latency holds histograms of conversions
+ * and of every sysfs and procfs entry point. Lock holds wait and hold times of
+ * the lock of the device by entry points, a write resets them
+ *
+ *   Mapping                                         |  Operations
+ * --------------------------------------------------|--------------
+ *   /sys/kernel/debug/bme280/<client>/regcache      |  read
+ *   /sys/kernel/debug/bme280/<client>/cache_hits    |  read
+ *   /sys/kernel/debug/bme280/<client>/cache_misses  |  read
+ *   /sys/kernel/debug/bme280/<client>/stats         |  read
+ *   /sys/kernel/debug/bme280/<client>/latency       |  read
+ *   /sys/kernel/debug/bme280/<client>/lock          |  read, write
+ *
+ * @param[in] device : Structure instance of bme280
+ */
+void bme280_attach_debug_mapp(struct bme280 *device);
+
+/**
+ * @brief Removes the debugging information mapping of the device. Waits for
+ * active readers, so must be called without lock of the device held
+ *
+ * @param[in] device : Structure instance of bme280
+ */
+void bme280_detach_debug_mapp(struct bme280 *device);
+
+#endif /* _BME280_DEBUG_MAPP_H */
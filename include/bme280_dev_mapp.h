@@ -0,0 +1,81 @@
+/**
+ * @brief Bosch Sensortec's BME280 samples mapping in character devices
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#ifndef _BME280_DEV_MAPP_H
+#define _BME280_DEV_MAPP_H
+
+#include <bme280.h>
+
+/**
+ * @brief Reserves the range of character device numbers, must be called after
+ * bme280_create_regs_mapp, which creates class bme280
+ *
+ * @return Result of execution
+ */
+ssize_t bme280_create_dev_mapp(void);
+
+/**
+ * @brief Releases the range of character device numbers
+ */
+void bme280_remove_dev_mapp(void);
+
+/**
+ * @brief Creates the character device of the device, reading it returns
+ * samples from the ring as struct bme280_record. Reads block until watermark
+ * of samples is accumulated, unless the file is opened with O_NONBLOCK. Poll
+ * reports the file readable once watermark is reached. Measurement attributes
+ * are notified on every sample, so they can be polled too
+ *
+ *   Mapping                                        |  Operations
+ * -------------------------------------------------|--------------
+ *   /dev/bme280-<adapter>-<address>                |  read/poll
+ *   /sys/class/bme280/bme280-<adapter>-<address>/  |
+ *     ring_depth                                   |  read/write
+ *     watermark                                    |  read/write
+ *     dropped                                      |  read
+ *     pipeline                                     |  read/write
+ *     pressure_precision                           |  read/write
+ *     pressure_fine                                |  read
+ *     pressure                                     |  read/poll
+ *     temperature                                  |  read/poll
+ *     humidity                                     |  read/poll
+ *     measurements                                 |  read/poll
+ *     chip_id, mode, osrs_p, osrs_t, osrs_h        |  see regs mapping
+ *     filter, standby_time, reset, dig_*           |  see regs mapping
+ *
+ * Register attributes of the device are the ones of bme280_create_regs_mapp,
+ * bound to the device instead of the current selected one. Pipeline is the
+ * staleness bound of pipelined forced conversions in milliseconds, zero
+ * disables pipelining, see bme280_get_sample. Pressure precision selects the
+ * 32-bit or 64-bit compensation formula, pressure_fine is in Pa / 256 and
+ * other measurements keep their units with both of them
+ *
+ * @param[in] device : Structure instance of bme280
+ *
+ * @return Result of execution
+ */
+ssize_t bme280_attach_dev_mapp(struct bme280 *device);
+
+/**
+ * @brief Removes the character device of the device. Waits for active
+ * attribute readers, so must be called without lock of the device held
+ *
+ * @param[in] device : Structure instance of bme280
+ */
+void bme280_detach_dev_mapp(struct bme280 *device);
+
+/**
+ * @brief Notifies pollers of measurement attributes of the device about a new
+ * sample of the sampler. Forced samples are taken by readers of the
+ * attributes themselves and are not notified. Must be called with lock of
+ * the device held
+ *
+ * @param[in] device : Structure instance of bme280
+ */
+void bme280_notify_dev_mapp(struct bme280 *device);
+
+#endif /* _BME280_DEV_MAPP_H */
@@ -0,0 +1,56 @@
+/**
+ * @brief Bosch Sensortec's BME280 mapping in Industrial I/O subsystem
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#ifndef _BME280_IIO_MAPP_H
+#define _BME280_IIO_MAPP_H
+
+#include <bme280.h>
+
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+
+/**
+ * @brief Registers the device in IIO with temperature, pressure and humidity
+ * channels and triggered buffer. Values are the latest sample of the
+ * sampler, or a forced measurement when sampler is stopped
+ *
+ *   Channel           |  Raw value  |  Scale
+ * --------------------|-------------|--------------------
+ *   temp              |  °C * 100   |  10 (m°C)
+ *   pressure          |  Pa         |  1 / 1000 (kPa)
+ *   humidityrelative  |  % * 1024   |  1000 / 1024 (m%)
+ *
+ * Oversampling ratio is separate for every channel, sampling frequency is
+ * shared by all channels and mapped onto the standby time of normal mode
+ *
+ * @param[in] device : Structure instance of bme280
+ *
+ * @return Result of execution
+ */
+ssize_t bme280_attach_iio_mapp(struct bme280 *device);
+
+/**
+ * @brief Unregisters the device from IIO. Waits for active readers and the
+ * triggered buffer, so must be called without lock of the device held
+ *
+ * @param[in] device : Structure instance of bme280
+ */
+void bme280_detach_iio_mapp(struct bme280 *device);
+
+#else
+
+static inline ssize_t bme280_attach_iio_mapp(struct bme280 *device)
+{
+	return 0;
+}
+
+static inline void bme280_detach_iio_mapp(struct bme280 *device)
+{
+}
+
+#endif /* CONFIG_IIO_TRIGGERED_BUFFER */
+
+#endif /* _BME280_IIO_MAPP_H */
@@ -14,9 +14,14 @@
  *   Mapping            |  Operations
  * ---------------------|--------------
  *   /proc/bme280info   |  read
+ *   /proc/bme280data   |  read
  *   /proc/bme280calib  |  read
  *
- * Calibration data available only when compiled with DEBUG
+ * bme280info and bme280calib hold a record for every registered device,
+ * records are separated by empty lines. bme280data holds pressure,
+ * temperature, humidity and timestamp of a single sample of the current
+ * selected device, separated by spaces. Calibration data available only when
+ * compiled with DEBUG
  *
  * @return Result of execution
  */
@@ -46,9 +46,13 @@
  *   /sys/class/bme280/pressure      |  read
  *   /sys/class/bme280/temperature   |  read
  *   /sys/class/bme280/humidity      |  read
+ *   /sys/class/bme280/measurements  |  read
  *
  * Calibration data registers available only when compiled with DEBUG. All
- * other registers available always
+ * other registers available always. Measurements holds pressure, temperature,
+ * humidity and timestamp of a single sample, separated by spaces. All
+ * attributes except i2c are attached to every device as well, see
+ * bme280_attach_dev_mapp
  *
  * @return Result of execution
  */
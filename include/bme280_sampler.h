@@ -0,0 +1,176 @@
+/**
+ * @brief Bosch Sensortec's BME280 continuous sampling in normal mode
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#ifndef _BME280_SAMPLER_H
+#define _BME280_SAMPLER_H
+
+#include <bme280.h>
+
+/** Depth of sample ring in records */
+#define BME280_RING_DEFAULT_DEPTH 128
+#define BME280_RING_MIN_DEPTH 2
+#define BME280_RING_MAX_DEPTH 1024
+
+/**
+ * @brief Initializes the sampler of the device and allocates the ring of
+ * samples, sampler is stopped. Ring depth is taken from the module parameter
+ * ring_depth
+ *
+ * @param[in,out] self : Structure instance of bme280
+ *
+ * @return Result of execution
+ */
+ssize_t bme280_init_sampler(struct bme280 *self);
+
+/**
+ * @brief Frees the ring of samples, sampler must be stopped and cancelled
+ *
+ * @param[in,out] self : Structure instance of bme280
+ */
+void bme280_deinit_sampler(struct bme280 *self);
+
+/**
+ * @brief Replaces the ring of samples with an empty one of the given depth,
+ * rounded up to power of two, watermark is clamped to the new depth. Must be
+ * called with lock of the device held
+ *
+ * @param[in,out] self : Structure instance of bme280
+ * @param[in] depth : Depth of ring in records
+ *
+ * @return Result of execution
+ */
+ssize_t bme280_set_ring_depth(struct bme280 *self, u32 depth);
+
+/**
+ * @brief Seeds the latest sample with a forced measurement and switches the
+ * device to normal mode. Sampling work runs every standby time plus
+ * measurement time, stores the latest sample and puts it into the ring of
+ * samples. Readers of the ring are woken up once it reaches its watermark,
+ * measurement attributes are notified on every sample. Must be called with
+ * lock of the device held, or before the device is registered
+ *
+ * @param[in,out] self : Structure instance of bme280
+ *
+ * @return Result of execution
+ * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
+ */
+ssize_t bme280_start_sampler(struct bme280 *self);
+
+/**
+ * @brief Stops sampling and puts the device to sleep mode. Blocked readers of
+ * the ring are woken up to drain it. Must be called with lock of the device
+ * held
+ *
+ * @param[in,out] self : Structure instance of bme280
+ *
+ * @return Result of execution
+ * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
+ */
+ssize_t bme280_stop_sampler(struct bme280 *self);
+
+/**
+ * @brief Waits for the running sampling work and cancels the pending one.
+ * Sampling work takes lock of the device, so must be called without it held
+ *
+ * @param[in,out] self : Structure instance of bme280
+ */
+void bme280_cancel_sampler(struct bme280 *self);
+
+/**
+ * @brief Starts a forced conversion for requests which arrived at the given
+ * time, unless sampler is running, a conversion which is not stale is
+ * already started or the latest sample is newer. Result is collected by
+ * bme280_get_sample, so several devices can convert in parallel. Must be
+ * called with lock of the device held
+ *
+ * @param[in,out] self : Structure instance of bme280
+ * @param[in] arrival : Monotonic time of the request in nanoseconds, taken
+ * before lock of the device is acquired
+ *
+ * @return Result of execution
+ * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
+ */
+ssize_t bme280_start_sample(struct bme280 *self, u64 arrival);
+
+/**
+ * @brief Gets the latest sample without accessing the device while sampler
+ * is running, otherwise measures in forced mode. Conversion started by
+ * bme280_start_sample is collected instead of starting a new one. Concurrent
+ * requests are coalesced, a request shares the result of a conversion which
+ * completed after it had arrived instead of starting a new one. Must be
+ * called with lock of the device held
+ *
+ * When pipeline of the device is set, the next conversion is started right
+ * after the result is collected, so the following request only reads data
+ * registers. Its sample is timestamped with the end of that conversion, and a
+ * conversion which ended longer than pipeline milliseconds before the request
+ * is discarded in favour of a fresh one
+ *
+ * @param[in,out] self : Structure instance of bme280
+ * @param[in] sensor_comp : Variable which selects which data to be
+ * compensated, channels of shared conversions are merged
+ *
+ *   sensor_comp  |  Macros
+ * ---------------|----------------
+ *   1            |  BME280_PRESS
+ *   2            |  BME280_TEMP
+ *   4            |  BME280_HUM
+ *   7            |  BME280_ALL
+ *
+ * @param[in] arrival : Monotonic time of the request in nanoseconds, taken
+ * before lock of the device is acquired
+ * @param[out] sample : Structure instance of bme280_sample
+ *
+ * @return Result of execution
+ * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
+ */
+ssize_t bme280_get_sample(struct bme280 *self, u8 sensor_comp, u64 arrival,
+			  struct bme280_sample *sample);
+
+/**
+ * @brief Gets the sample like bme280_get_sample, but leaves compensation to
+ * the caller. Calibration data is copied along with the sample, so it can be
+ * compensated by bme280_compensate_data after lock of the device is dropped.
+ * Must be called with lock of the device held
+ *
+ * @param[in,out] self : Structure instance of bme280
+ * @param[in] arrival : Monotonic time of the request in nanoseconds, taken
+ * before lock of the device is acquired
+ * @param[out] sample : Structure instance of bme280_sample, compensated data
+ * of it is not valid
+ * @param[out] calib_data : Structure instance of bme280_calib_data
+ *
+ * @return Result of execution
+ * @retval zero -> Success / +ve value -> Warning / -ve value -> Error
+ */
+ssize_t bme280_get_raw_sample(struct bme280 *self, u64 arrival,
+			      struct bme280_sample *sample,
+			      struct bme280_calib_data *calib_data);
+
+/**
+ * @brief Samples many devices at once. Forced conversions of all devices are
+ * started back to back, then the longest predicted measurement time is
+ * waited once and data registers of all devices are read. Samples of N
+ * devices take about the longest measurement time instead of the sum of them
+ * and are nearly simultaneous. Data registers of devices which share an I2C
+ * adapter are read by a single transfer, up to eight devices per transfer.
+ * Must be called without any lock of a device held
+ *
+ * @param[in] devices : Array of devices, NULL entries are skipped
+ * @param[in] count : Number of devices
+ * @param[in] sensor_comp : Variable which selects which data to be
+ * compensated, see bme280_get_sample
+ * @param[in] arrival : Monotonic time of the request in nanoseconds
+ * @param[out] samples : Array of samples, one per device
+ * @param[out] results : Array of results of execution, one per device, -ENODEV
+ * for missing or removed devices
+ */
+void bme280_sample_devices(struct bme280 **devices, size_t count,
+			   u8 sensor_comp, u64 arrival,
+			   struct bme280_sample *samples, ssize_t *results);
+
+#endif /* _BME280_SAMPLER_H */
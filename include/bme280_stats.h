@@ -0,0 +1,203 @@
+/**
+ * @brief Bosch Sensortec's BME280 statistics of bus transactions, conversions
+ * and entry points of the driver
+ *
+ * Counters are atomics updated without lock of the device, so readers of
+ * statistics never wait for a conversion. Latencies are accounted in
+ * histograms with log2 buckets of microseconds
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#ifndef _BME280_STATS_H
+#define _BME280_STATS_H
+
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/timekeeping.h>
+#include <linux/types.h>
+
+/**
+ * Bucket 0 counts latencies below 1 µs, bucket N counts latencies from 2^(N-1)
+ * to 2^N µs and the last one counts all longer latencies
+ */
+#define BME280_HIST_BUCKETS 24
+
+/**
+ * Entry points of sysfs and procfs with their own latency histograms, all
+ * calibration data attributes share a single one. Other users of locks of the
+ * registry and of devices are accounted as entry points of lock statistics
+ */
+#define BME280_ENTRY_POINTS(ENTRY)                                             \
+	ENTRY(chip_id_show)                                                    \
+	ENTRY(calib_show)                                                      \
+	ENTRY(reset_store)                                                     \
+	ENTRY(mode_show)                                                       \
+	ENTRY(mode_store)                                                      \
+	ENTRY(osrs_p_show)                                                     \
+	ENTRY(osrs_p_store)                                                    \
+	ENTRY(osrs_t_show)                                                     \
+	ENTRY(osrs_t_store)                                                    \
+	ENTRY(osrs_h_show)                                                     \
+	ENTRY(osrs_h_store)                                                    \
+	ENTRY(filter_show)                                                     \
+	ENTRY(filter_store)                                                    \
+	ENTRY(standby_time_show)                                               \
+	ENTRY(standby_time_store)                                              \
+	ENTRY(pressure_show)                                                   \
+	ENTRY(temperature_show)                                                \
+	ENTRY(humidity_show)                                                   \
+	ENTRY(measurements_show)                                               \
+	ENTRY(ring_depth_show)                                                 \
+	ENTRY(ring_depth_store)                                                \
+	ENTRY(watermark_show)                                                  \
+	ENTRY(watermark_store)                                                 \
+	ENTRY(dropped_show)                                                    \
+	ENTRY(pipeline_show)                                                   \
+	ENTRY(pipeline_store)                                                  \
+	ENTRY(pressure_precision_show)                                         \
+	ENTRY(pressure_precision_store)                                        \
+	ENTRY(pressure_fine_show)                                              \
+	ENTRY(proc_info)                                                       \
+	ENTRY(proc_data)                                                       \
+	ENTRY(proc_calib)                                                      \
+	ENTRY(i2c_store)                                                       \
+	ENTRY(probe)                                                           \
+	ENTRY(remove)                                                          \
+	ENTRY(sampler)                                                         \
+	ENTRY(batch_read)                                                      \
+	ENTRY(chardev_read)                                                    \
+	ENTRY(chardev_poll)                                                    \
+	ENTRY(iio_read)                                                        \
+	ENTRY(iio_write)                                                       \
+	ENTRY(iio_trigger)                                                     \
+	ENTRY(regcache)
+
+#define BME280_ENTRY_ID(name) BME280_ENTRY_##name,
+
+enum bme280_entry { BME280_ENTRY_POINTS(BME280_ENTRY_ID) BME280_ENTRY_MAX };
+
+struct bme280_hist {
+	atomic64_t buckets[BME280_HIST_BUCKETS]; /**< Number of latencies in
+		each bucket */
+};
+
+/**
+ * @brief Wait and hold times of a lock taken by an entry point, in
+ * nanoseconds
+ */
+struct bme280_lock_stats {
+	atomic_t count; /**< Number of times the lock was taken */
+	atomic64_t wait_sum; /**< Sum of waits for the lock */
+	atomic64_t wait_max; /**< Longest wait for the lock */
+	atomic64_t hold_sum; /**< Sum of hold times of the lock */
+	atomic64_t hold_max; /**< Longest hold time of the lock */
+	struct bme280_hist wait; /**< Histogram of waits for the lock */
+	struct bme280_hist hold; /**< Histogram of hold times of the lock */
+};
+
+struct bme280_stats {
+	atomic_t reads; /**< Number of read transactions on the bus */
+	atomic_t writes; /**< Number of write transactions on the bus */
+	atomic64_t read_bytes; /**< Number of register bytes read */
+	atomic64_t write_bytes; /**< Number of register address and value bytes
+		written */
+	atomic_t comm_errors; /**< Number of failed bus transactions */
+	atomic_t forced_conversions; /**< Number of forced conversions
+		triggered, including conversions of batches */
+	atomic_t status_polls; /**< Number of status reads while waiting for a
+		conversion */
+	atomic_t nvm_copy_failures; /**< Number of soft resets after which NVM
+		data was not copied */
+	struct bme280_hist conversions; /**< Latencies from the trigger of a
+		forced conversion to its collected result */
+	struct bme280_hist entries[BME280_ENTRY_MAX]; /**< Latencies of entry
+		points from arrival of a request until it releases the device */
+	struct bme280_lock_stats locks[BME280_ENTRY_MAX]; /**< Wait and hold
+		times of lock of the device by entry points */
+};
+
+/**
+ * @brief Adds a latency to the histogram
+ *
+ * @param[in] hist : Histogram of latencies
+ * @param[in] latency : Latency in nanoseconds
+ */
+static inline void bme280_hist_add(struct bme280_hist *hist, u64 latency)
+{
+	unsigned int bucket = fls64(div_u64(latency, NSEC_PER_USEC));
+
+	bucket = min_t(unsigned int, bucket, BME280_HIST_BUCKETS - 1);
+	atomic64_inc(&hist->buckets[bucket]);
+}
+
+/**
+ * @brief Raises the maximum to the value, concurrent updates keep the
+ * largest one
+ *
+ * @param[in,out] max : Maximum
+ * @param[in] value : Value
+ */
+static inline void bme280_stats_max(atomic64_t *max, u64 value)
+{
+	s64 last = atomic64_read(max);
+	s64 prev;
+
+	while ((u64)last < value) {
+		prev = atomic64_cmpxchg(max, last, value);
+		if (prev == last) {
+			break;
+		}
+
+		last = prev;
+	}
+}
+
+/**
+ * @brief Accounts an acquisition of the lock after the given wait
+ *
+ * @param[in] stats : Lock statistics of the entry point
+ * @param[in] wait : Wait for the lock in nanoseconds
+ */
+static inline void bme280_lock_stats_wait(struct bme280_lock_stats *stats,
+					  u64 wait)
+{
+	atomic_inc(&stats->count);
+	atomic64_add(wait, &stats->wait_sum);
+	bme280_stats_max(&stats->wait_max, wait);
+	bme280_hist_add(&stats->wait, wait);
+}
+
+/**
+ * @brief Accounts a release of the lock after the given hold time
+ *
+ * @param[in] stats : Lock statistics of the entry point
+ * @param[in] hold : Hold time of the lock in nanoseconds
+ */
+static inline void bme280_lock_stats_hold(struct bme280_lock_stats *stats,
+					  u64 hold)
+{
+	atomic64_add(hold, &stats->hold_sum);
+	bme280_stats_max(&stats->hold_max, hold);
+	bme280_hist_add(&stats->hold, hold);
+}
+
+/**
+ * @brief Accounts a request of the entry point, which arrived at the given
+ * time and is done with the device now. Must be called before the device is
+ * released, since a removed device may be freed after that
+ *
+ * @param[in] stats : Statistics of the device
+ * @param[in] entry : Entry point of the request
+ * @param[in] arrival : Monotonic time of the request arrival in nanoseconds
+ */
+static inline void bme280_stats_entry(struct bme280_stats *stats,
+				      enum bme280_entry entry, u64 arrival)
+{
+	bme280_hist_add(&stats->entries[entry], ktime_get_ns() - arrival);
+}
+
+#endif /* _BME280_STATS_H */
@@ -0,0 +1,238 @@
+/**
+ * @brief Bosch Sensortec's BME280 tracepoints of bus transactions,
+ * conversions, compensation, registry lock and locks of devices
+ *
+ * Events are in the bme280 system of ftrace, a disabled event costs a single
+ * static branch. Durations are in nanoseconds, waits of conversions in
+ * microseconds
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM bme280
+
+#if !defined(_BME280_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BME280_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include <bme280.h>
+
+/* clang-format off */
+
+/******************************* Register Access ******************************/
+
+DECLARE_EVENT_CLASS(bme280_regs_start,
+	TP_PROTO(const struct bme280 *self, u8 reg_addr, u8 len),
+	TP_ARGS(self, reg_addr, len),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(u16, addr)
+		__field(u8, reg_addr)
+		__field(u8, len)
+	),
+	TP_fast_assign(
+		__entry->adapter = self->client->adapter->nr;
+		__entry->addr = self->client->addr;
+		__entry->reg_addr = reg_addr;
+		__entry->len = len;
+	),
+	TP_printk("device=%d-0x%x reg=0x%02x len=%u", __entry->adapter,
+		  __entry->addr, __entry->reg_addr, __entry->len)
+);
+
+DEFINE_EVENT(bme280_regs_start, bme280_get_regs_start,
+	TP_PROTO(const struct bme280 *self, u8 reg_addr, u8 len),
+	TP_ARGS(self, reg_addr, len)
+);
+
+DEFINE_EVENT(bme280_regs_start, bme280_set_regs_start,
+	TP_PROTO(const struct bme280 *self, u8 reg_addr, u8 len),
+	TP_ARGS(self, reg_addr, len)
+);
+
+DECLARE_EVENT_CLASS(bme280_regs_end,
+	TP_PROTO(const struct bme280 *self, u8 reg_addr, u8 len, ssize_t ret,
+		 u64 duration),
+	TP_ARGS(self, reg_addr, len, ret, duration),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(u16, addr)
+		__field(u8, reg_addr)
+		__field(u8, len)
+		__field(int, ret)
+		__field(u64, duration)
+	),
+	TP_fast_assign(
+		__entry->adapter = self->client->adapter->nr;
+		__entry->addr = self->client->addr;
+		__entry->reg_addr = reg_addr;
+		__entry->len = len;
+		__entry->ret = ret;
+		__entry->duration = duration;
+	),
+	TP_printk("device=%d-0x%x reg=0x%02x len=%u ret=%d duration=%llu",
+		  __entry->adapter, __entry->addr, __entry->reg_addr,
+		  __entry->len, __entry->ret, __entry->duration)
+);
+
+DEFINE_EVENT(bme280_regs_end, bme280_get_regs_end,
+	TP_PROTO(const struct bme280 *self, u8 reg_addr, u8 len, ssize_t ret,
+		 u64 duration),
+	TP_ARGS(self, reg_addr, len, ret, duration)
+);
+
+DEFINE_EVENT(bme280_regs_end, bme280_set_regs_end,
+	TP_PROTO(const struct bme280 *self, u8 reg_addr, u8 len, ssize_t ret,
+		 u64 duration),
+	TP_ARGS(self, reg_addr, len, ret, duration)
+);
+
+/***************************** Forced Conversions *****************************/
+
+/** Predicted measurement time is in microseconds */
+TRACE_EVENT(bme280_conversion_trigger,
+	TP_PROTO(const struct bme280 *self, u32 meas_time),
+	TP_ARGS(self, meas_time),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(u16, addr)
+		__field(u32, meas_time)
+	),
+	TP_fast_assign(
+		__entry->adapter = self->client->adapter->nr;
+		__entry->addr = self->client->addr;
+		__entry->meas_time = meas_time;
+	),
+	TP_printk("device=%d-0x%x meas_time=%u", __entry->adapter,
+		  __entry->addr, __entry->meas_time)
+);
+
+/** Latency is the time from the trigger to the collected result */
+TRACE_EVENT(bme280_conversion_done,
+	TP_PROTO(const struct bme280 *self, u64 latency, ssize_t ret),
+	TP_ARGS(self, latency, ret),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(u16, addr)
+		__field(u64, latency)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->adapter = self->client->adapter->nr;
+		__entry->addr = self->client->addr;
+		__entry->latency = latency;
+		__entry->ret = ret;
+	),
+	TP_printk("device=%d-0x%x latency=%llu ret=%d", __entry->adapter,
+		  __entry->addr, __entry->latency, __entry->ret)
+);
+
+/** Every status read of the wait for a conversion */
+TRACE_EVENT(bme280_meas_poll,
+	TP_PROTO(const struct bme280 *self, u32 waited, u8 status),
+	TP_ARGS(self, waited, status),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(u16, addr)
+		__field(u32, waited)
+		__field(u8, status)
+	),
+	TP_fast_assign(
+		__entry->adapter = self->client->adapter->nr;
+		__entry->addr = self->client->addr;
+		__entry->waited = waited;
+		__entry->status = status;
+	),
+	TP_printk("device=%d-0x%x waited=%u status=0x%02x", __entry->adapter,
+		  __entry->addr, __entry->waited, __entry->status)
+);
+
+/******************************** Compensation ********************************/
+
+TRACE_EVENT(bme280_compensate,
+	TP_PROTO(u8 sensor_comp, const struct bme280_uncomp_data *uncomp_data,
+		 const struct bme280_data *comp_data),
+	TP_ARGS(sensor_comp, uncomp_data, comp_data),
+	TP_STRUCT__entry(
+		__field(u8, sensor_comp)
+		__field(u32, uncomp_pressure)
+		__field(u32, uncomp_temperature)
+		__field(u32, uncomp_humidity)
+		__field(u32, pressure)
+		__field(s32, temperature)
+		__field(u32, humidity)
+	),
+	TP_fast_assign(
+		__entry->sensor_comp = sensor_comp;
+		__entry->uncomp_pressure = uncomp_data->pressure;
+		__entry->uncomp_temperature = uncomp_data->temperature;
+		__entry->uncomp_humidity = uncomp_data->humidity;
+		__entry->pressure = comp_data->pressure;
+		__entry->temperature = comp_data->temperature;
+		__entry->humidity = comp_data->humidity;
+	),
+	TP_printk("comp=0x%x raw=%u/%u/%u pressure=%u temperature=%d"
+		  " humidity=%u", __entry->sensor_comp,
+		  __entry->uncomp_pressure, __entry->uncomp_temperature,
+		  __entry->uncomp_humidity, __entry->pressure,
+		  __entry->temperature, __entry->humidity)
+);
+
+/********************************** Locks *************************************/
+
+/** Device is NULL for the registry lock, its adapter is then -1 */
+DECLARE_EVENT_CLASS(bme280_lock_duration,
+	TP_PROTO(const struct bme280 *self, u64 duration),
+	TP_ARGS(self, duration),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(u16, addr)
+		__field(u64, duration)
+	),
+	TP_fast_assign(
+		__entry->adapter = self ? self->client->adapter->nr : -1;
+		__entry->addr = self ? self->client->addr : 0;
+		__entry->duration = duration;
+	),
+	TP_printk("device=%d-0x%x duration=%llu", __entry->adapter,
+		  __entry->addr, __entry->duration)
+);
+
+/** Duration is the wait for the lock */
+DEFINE_EVENT(bme280_lock_duration, bme280_devices_lock_acquire,
+	TP_PROTO(const struct bme280 *self, u64 duration),
+	TP_ARGS(self, duration)
+);
+
+/** Duration is the hold time of the lock */
+DEFINE_EVENT(bme280_lock_duration, bme280_devices_lock_release,
+	TP_PROTO(const struct bme280 *self, u64 duration),
+	TP_ARGS(self, duration)
+);
+
+/** Duration is the wait for the lock */
+DEFINE_EVENT(bme280_lock_duration, bme280_device_lock_acquire,
+	TP_PROTO(const struct bme280 *self, u64 duration),
+	TP_ARGS(self, duration)
+);
+
+/** Duration is the hold time of the lock */
+DEFINE_EVENT(bme280_lock_duration, bme280_device_lock_release,
+	TP_PROTO(const struct bme280 *self, u64 duration),
+	TP_ARGS(self, duration)
+);
+
+/* clang-format on */
+
+#endif /* _BME280_TRACE_H */
+
+/** Out of tree, so the header is found by the include path of the module */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE bme280_trace
+
+#include <trace/define_trace.h>
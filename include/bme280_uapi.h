@@ -0,0 +1,85 @@
+/**
+ * @brief Bosch Sensortec's BME280 binary records shared with user space
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#ifndef _BME280_UAPI_H
+#define _BME280_UAPI_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/**
+ * @brief Sample record read from /dev/bme280-<adapter>-<address>, records
+ * have fixed size and layout
+ */
+struct bme280_record {
+	__u64 timestamp; /**< Monotonic time of the sample in nanoseconds */
+	__u32 sequence; /**< Sequence number of the sample, gaps mean that
+		samples were dropped on overflow */
+	__u32 uncomp_pressure; /**< Uncompensated pressure */
+	__u32 uncomp_temperature; /**< Uncompensated temperature */
+	__u32 uncomp_humidity; /**< Uncompensated humidity */
+	__u32 pressure; /**< Compensated pressure, Pa */
+	__s32 temperature; /**< Compensated temperature, °C * 100 */
+	__u32 humidity; /**< Compensated humidity, % * 1024 */
+	__u32 reserved; /**< Padding, always zero */
+};
+
+/** Channels of batch read, same as sensor component selection macros */
+#define BME280_BATCH_PRESS 1
+#define BME280_BATCH_TEMP (1 << 1)
+#define BME280_BATCH_HUM (1 << 2)
+#define BME280_BATCH_ALL_CHANNELS 0x07
+
+/** Batch read flags */
+#define BME280_BATCH_ALL_DEVICES 1 /**< Read every registered device */
+
+/** Maximum number of records of a single batch read */
+#define BME280_BATCH_MAX_RECORDS 256
+
+/**
+ * @brief Record of a single device in a batch read, records have fixed size
+ * and layout. Channels which are not requested are zero. On input only adapter
+ * and address are read, other fields, reserved included, are ignored
+ */
+struct bme280_batch_record {
+	__u32 adapter; /**< I2C adapter number of the device */
+	__u32 address; /**< I2C address of the device */
+	__s32 error; /**< Zero on success, negative errno otherwise */
+	__u32 reserved; /**< Padding, always zero */
+	__u64 timestamp; /**< Monotonic time of the sample in nanoseconds */
+	__u32 uncomp_pressure; /**< Uncompensated pressure */
+	__u32 uncomp_temperature; /**< Uncompensated temperature */
+	__u32 uncomp_humidity; /**< Uncompensated humidity */
+	__u32 pressure; /**< Compensated pressure, Pa */
+	__s32 temperature; /**< Compensated temperature, °C * 100 */
+	__u32 humidity; /**< Compensated humidity, % * 1024 */
+};
+
+/**
+ * @brief Argument of BME280_IOC_BATCH_READ. Adapter and address of records
+ * select devices, unless BME280_BATCH_ALL_DEVICES is set, then records are
+ * filled for every registered device. Count is the number of records on
+ * input and the number of filled records on output. If registered devices
+ * don't fit into records, ENOSPC is returned and count holds their number.
+ * Nonzero reserved is rejected with EINVAL
+ */
+struct bme280_batch {
+	__u32 flags; /**< Batch read flags */
+	__u32 channels; /**< Channels to be compensated */
+	__u32 count; /**< Number of records */
+	__u32 reserved; /**< Padding, must be zero */
+	__u64 records; /**< Pointer to array of bme280_batch_record */
+};
+
+/**
+ * Reads every selected device by a single call of /dev/bme280. Conversions
+ * of all devices are started before any result is collected
+ */
+#define BME280_IOC_MAGIC 0xB2
+#define BME280_IOC_BATCH_READ _IOWR(BME280_IOC_MAGIC, 1, struct bme280_batch)
+
+#endif /* _BME280_UAPI_H */
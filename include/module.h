@@ -1,6 +1,90 @@
 #ifndef _MODULE_H
 #define _MODULE_H
 
+#include <linux/types.h>
+#include <linux/mutex.h>
+
+#include <bme280_stats.h>
+
 #define THIS_MODULE_NAME "bme280"
 
+struct bme280;
+
+/**
+ * @brief Takes a reference to the device, it stays allocated until the
+ * reference is dropped even if the device is unregistered
+ *
+ * @param[in,out] device : Structure instance of bme280
+ */
+void bme280_get_device(struct bme280 *device);
+
+/**
+ * @brief Drops a reference to the device, the last one frees it
+ *
+ * @param[in,out] device : Structure instance of bme280
+ */
+void bme280_put_device(struct bme280 *device);
+
+/**
+ * @brief Locks the registry of devices, bme280_devices_lock. Wait and hold
+ * times of it are traced and accounted to the entry point
+ *
+ * @param[in] entry : Entry point which takes the lock
+ */
+void bme280_lock_devices(enum bme280_entry entry);
+
+/**
+ * @brief Unlocks the registry of devices
+ */
+void bme280_unlock_devices(void);
+
+/**
+ * @brief Locks the device, wait and hold times of its lock are accounted to
+ * the entry point
+ *
+ * @param[in,out] device : Structure instance of bme280
+ * @param[in] entry : Entry point which takes the lock
+ */
+void bme280_lock_device(struct bme280 *device, enum bme280_entry entry);
+
+/**
+ * @brief Locks the device while the given lock is held, which serializes
+ * locking of several devices
+ *
+ * @param[in,out] device : Structure instance of bme280
+ * @param[in] entry : Entry point which takes the lock
+ * @param[in] nest_lock : Lock held to take locks of several devices
+ */
+void bme280_lock_device_nest(struct bme280 *device, enum bme280_entry entry,
+			     struct mutex *nest_lock);
+
+/**
+ * @brief Unlocks the device
+ *
+ * @param[in,out] device : Structure instance of bme280
+ */
+void bme280_unlock_device(struct bme280 *device);
+
+/**
+ * @brief Takes a reference to the current selected device and locks it. The
+ * lookup is lock-free under RCU, so it never contends with registration of
+ * other devices
+ *
+ * @param[out] device : Structure instance of bme280, NULL on failure
+ * @param[in] entry : Entry point which takes the lock
+ *
+ * @return Result of execution
+ * @retval zero -> Success / -ve value -> Error
+ */
+ssize_t bme280_lock_selected_device(struct bme280 **device,
+				    enum bme280_entry entry);
+
+/**
+ * @brief Unlocks the device and drops a reference to it, does nothing for
+ * NULL
+ *
+ * @param[in,out] device : Structure instance of bme280
+ */
+void bme280_unlock_selected_device(struct bme280 *device);
+
 #endif /* _MODULE_H */
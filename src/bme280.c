@@ -1,26 +1,154 @@
+#include <linux/kernel.h>
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/math64.h>
+#include <linux/timekeeping.h>
 
 #include <bme280.h>
 
+#define CREATE_TRACE_POINTS
+#include <bme280_trace.h>
+
 #define BME280_TEMP_MIN -4000
 #define BME280_TEMP_MAX 8500
 
 #define BME280_PRESS_MIN 30000
 #define BME280_PRESS_MAX 110000
 
+/** Pressure of the 64-bit formula has 8 fractional bits */
+#define PRESS_FINE_SCALE 256
+
 #define BME280_HUM_MAX 102400
 
 #define OVERSAMPLING_SETTINGS 0x07
 #define FILTER_STANDBY_SETTINGS 0x18
 
+/** Maximum number of registers written by a single bus transaction */
+#define BURST_WRITE_MAX_LEN 8
+
+/**
+ * Interval between status reads when a conversion takes longer than expected,
+ * in microseconds
+ */
+#define MEAS_POLL_INTERVAL_US 1000
+
 /***************************** Common Functions *******************************/
 
-static inline ssize_t null_ptr_check(const struct bme280 *self)
+static inline ssize_t null_ptr_check(struct bme280 *self)
 {
 	return self == NULL ? BME280_E_NULL_PTR : BME280_OK;
 }
 
+/************************** Register Map Functions ****************************/
+
+static int read_block(struct bme280 *self, u8 reg_addr, u8 *reg_data,
+		      size_t len)
+{
+	s32 ret;
+
+	ret = i2c_smbus_read_i2c_block_data(self->client, reg_addr, len,
+					    reg_data);
+	if (ret != len) {
+		atomic_inc(&self->stats->comm_errors);
+
+		return ret < 0 ? ret : -EIO;
+	}
+
+	atomic_inc(&self->stats->reads);
+	atomic64_add(len, &self->stats->read_bytes);
+
+	return 0;
+}
+
+static int regmap_bus_read(void *context, const void *reg_buf,
+			   size_t reg_size, void *val_buf, size_t val_size)
+{
+	struct bme280 *self = context;
+
+	u8 reg_addr = *(const u8 *)reg_buf;
+	size_t i;
+	s32 ret;
+
+	ret = read_block(self, reg_addr, val_buf, val_size);
+	if (ret) {
+		return ret;
+	}
+
+	/** Bus reads of cached registers happen only on cache misses */
+	for (i = 0; i < val_size; i++) {
+		if (!bme280_is_volatile_reg(reg_addr + i)) {
+			self->cache_misses++;
+		}
+	}
+
+	return 0;
+}
+
+static int regmap_bus_write(void *context, const void *data, size_t count)
+{
+	struct bme280 *self = context;
+
+	const u8 *buf = data;
+	size_t i;
+	s32 ret;
+
+	/**
+	 * Data is a sequence of register address and value pairs, device
+	 * accepts the whole sequence as a single write message
+	 */
+	if (i2c_check_functionality(self->client->adapter, I2C_FUNC_I2C)) {
+		ret = i2c_master_send(self->client, data, count);
+		if (ret != count) {
+			atomic_inc(&self->stats->comm_errors);
+
+			return ret < 0 ? ret : -EIO;
+		}
+
+		atomic_inc(&self->stats->writes);
+		atomic64_add(count, &self->stats->write_bytes);
+
+		return 0;
+	}
+
+	for (i = 0; i + 1 < count; i += 2) {
+		ret = i2c_smbus_write_byte_data(self->client, buf[i],
+						buf[i + 1]);
+		if (ret) {
+			atomic_inc(&self->stats->comm_errors);
+
+			return ret;
+		}
+
+		atomic_inc(&self->stats->writes);
+		atomic64_add(2, &self->stats->write_bytes);
+	}
+
+	return 0;
+}
+
+static const struct regmap_bus bme280_regmap_bus = {
+	.read = regmap_bus_read,
+	.write = regmap_bus_write,
+	.max_raw_read = I2C_SMBUS_BLOCK_MAX,
+	.reg_format_endian_default = REGMAP_ENDIAN_NATIVE,
+	.val_format_endian_default = REGMAP_ENDIAN_NATIVE,
+};
+
+static bool regmap_volatile_reg(struct device *dev, unsigned int reg)
+{
+	return bme280_is_volatile_reg(reg);
+}
+
+static const struct regmap_config bme280_regmap_config = {
+	.name = "bme280",
+	.reg_bits = 8,
+	.val_bits = 8,
+	.max_register = BME280_DATA_ADDR + BME280_PRESS_TEMP_HUM_DATA_LEN - 1,
+	.volatile_reg = regmap_volatile_reg,
+	.cache_type = REGCACHE_RBTREE,
+	.can_multi_write = true,
+};
+
 /******************** Device Calibration Data Functions ***********************/
 
 static void parse_temp_press_calib_data(struct bme280 *self, const u8 *reg_data)
@@ -69,6 +197,18 @@ static void parse_humidity_calib_data(struct bme280 *self, const u8 *reg_data)
 	calib_data->dig_H6 = (s8)reg_data[6];
 }
 
+static void init_comp_context(struct bme280_calib_data *calib_data)
+{
+	struct bme280_comp_context *context = &calib_data->context;
+
+	context->t1 = (s32)calib_data->dig_T1;
+	context->t1_x2 = (s32)calib_data->dig_T1 * 2;
+	context->p4_x65536 = (s32)calib_data->dig_P4 * 65536;
+	context->p5_x2 = (s32)calib_data->dig_P5 * 2;
+	context->h4_offset = (s32)16384 - (s32)calib_data->dig_H4 * 1048576;
+	context->p4_x2_35 = (s64)calib_data->dig_P4 * ((s64)1 << 35);
+}
+
 static ssize_t get_calib_data(struct bme280 *self)
 {
 	ssize_t ret;
@@ -92,6 +232,8 @@ static ssize_t get_calib_data(struct bme280 *self)
 	}
 	parse_humidity_calib_data(self, calib_data);
 
+	init_comp_context(&self->calib_data);
+
 	return BME280_OK;
 
 err:
@@ -105,6 +247,22 @@ static inline u8 are_settings_changed(u8 sub_settings, u8 desired_settings)
 	return sub_settings & desired_settings ? 1 : 0;
 }
 
+/**
+ * Mode bits of ctrl_meas change by themselves when a forced conversion ends,
+ * so the register is built from the settings of the device, not read back
+ */
+static inline u8 build_ctrl_meas(const struct bme280_settings *settings,
+				 u8 sensor_mode)
+{
+	union bme280_ctrl_meas ctrl_meas = { .reg = 0 };
+
+	ctrl_meas.osrs_p = settings->osrs_p;
+	ctrl_meas.osrs_t = settings->osrs_t;
+	ctrl_meas.mode = sensor_mode;
+
+	return ctrl_meas.reg;
+}
+
 static void parse_device_settings(const union bme280_config *config,
 				  const union bme280_ctrl_meas *ctrl_meas,
 				  const union bme280_ctrl_hum *ctrl_hum,
@@ -117,189 +275,199 @@ static void parse_device_settings(const union bme280_config *config,
 	settings->standby_time = config->t_sb;
 }
 
-static ssize_t
-set_osrs_press_temp_settings(const struct bme280 *self, u8 desired_settings,
-			     const struct bme280_settings *settings)
+/** Parses registers of BME280_SNAPSHOT_ADDR..BME280_SNAPSHOT_LEN */
+static void parse_snapshot(const u8 *reg_data,
+			   struct bme280_snapshot *snapshot)
 {
-	ssize_t ret;
-
-	u8 reg_addr = BME280_CTRL_MEAS_ADDR;
+	union bme280_config config;
 	union bme280_ctrl_meas ctrl_meas;
+	union bme280_ctrl_hum ctrl_hum;
 
-	ret = bme280_get_regs(self, reg_addr, &ctrl_meas.reg, 1);
-	if (ret != BME280_OK) {
-		goto err;
-	}
+	ctrl_hum.reg = reg_data[BME280_CTRL_HUM_ADDR - BME280_SNAPSHOT_ADDR];
+	ctrl_meas.reg = reg_data[BME280_CTRL_MEAS_ADDR - BME280_SNAPSHOT_ADDR];
+	config.reg = reg_data[BME280_CONFIG_ADDR - BME280_SNAPSHOT_ADDR];
+
+	snapshot->mode = ctrl_meas.mode;
+	snapshot->status = reg_data[BME280_STATUS_ADDR - BME280_SNAPSHOT_ADDR];
+	parse_device_settings(&config, &ctrl_meas, &ctrl_hum,
+			      &snapshot->settings);
+	bme280_parse_sensor_data(
+		&reg_data[BME280_DATA_ADDR - BME280_SNAPSHOT_ADDR],
+		&snapshot->uncomp_data);
+}
 
-	if (desired_settings & BME280_OSRS_PRESS_SEL) {
-		ctrl_meas.osrs_p = settings->osrs_p;
-	}
+/**
+ * Collects ctrl_hum, ctrl_meas and config into a single burst write. Device
+ * must be in sleep mode, ctrl_meas is written after ctrl_hum for humidity
+ * changes to become effective
+ */
+static ssize_t write_device_settings(struct bme280 *self, u8 desired_settings,
+				     const struct bme280_settings *settings)
+{
+	ssize_t ret = BME280_OK;
 
-	if (desired_settings & BME280_OSRS_TEMP_SEL) {
-		ctrl_meas.osrs_t = settings->osrs_t;
-	}
+	u8 reg_addr[3];
+	u8 reg_data[3];
+	u8 len = 0;
 
-	ret = bme280_set_regs(self, &reg_addr, &ctrl_meas.reg, 1);
+	union bme280_config config;
+	union bme280_ctrl_hum ctrl_hum = { .reg = 0 };
 
-err:
-	return ret;
-}
+	if (desired_settings & BME280_OSRS_HUM_SEL) {
+		ctrl_hum.osrs_h = settings->osrs_h;
 
-static ssize_t
-set_osrs_humidity_settings(const struct bme280 *self,
-			   const struct bme280_settings *settings)
-{
-	ssize_t ret;
+		reg_addr[len] = BME280_CTRL_HUM_ADDR;
+		reg_data[len++] = ctrl_hum.reg;
+	}
 
-	u8 reg_addr = BME280_CTRL_HUM_ADDR;
-	union bme280_ctrl_hum ctrl_hum;
-	union bme280_ctrl_meas ctrl_meas;
+	if (are_settings_changed(OVERSAMPLING_SETTINGS, desired_settings)) {
+		/** Settings hold oversampling which isn't changed as well */
+		reg_addr[len] = BME280_CTRL_MEAS_ADDR;
+		reg_data[len++] = build_ctrl_meas(settings, BME280_SLEEP_MODE);
+	}
 
-	ctrl_hum.osrs_h = settings->osrs_h;
+	if (are_settings_changed(FILTER_STANDBY_SETTINGS, desired_settings)) {
+		ret = bme280_get_regs(self, BME280_CONFIG_ADDR, &config.reg, 1);
+		if (ret != BME280_OK) {
+			goto err;
+		}
 
-	ret = bme280_set_regs(self, &reg_addr, &ctrl_hum.reg, 1);
-	if (ret != BME280_OK) {
-		goto err;
-	}
+		if (desired_settings & BME280_FILTER_SEL) {
+			config.filter = settings->filter;
+		}
 
-	reg_addr = BME280_CTRL_MEAS_ADDR;
+		if (desired_settings & BME280_STANDBY_TIME_SEL) {
+			config.t_sb = settings->standby_time;
+		}
 
-	ret = bme280_get_regs(self, reg_addr, &ctrl_meas.reg, 1);
-	if (ret != BME280_OK) {
-		goto err;
+		reg_addr[len] = BME280_CONFIG_ADDR;
+		reg_data[len++] = config.reg;
 	}
 
-	ret = bme280_set_regs(self, &reg_addr, &ctrl_meas.reg, 1);
+	if (len) {
+		ret = bme280_set_regs(self, reg_addr, reg_data, len);
+	}
 
 err:
 	return ret;
 }
 
-static ssize_t set_osrs_settings(const struct bme280 *self, u8 desired_settings,
-				 const struct bme280_settings *settings)
-{
-	ssize_t ret = BME280_W_INVALID_OSRS_MACRO;
-
-	if (desired_settings & BME280_OSRS_HUM_SEL) {
-		ret = set_osrs_humidity_settings(self, settings);
-	}
+/********************** Device Power Control Functions ************************/
 
-	if (desired_settings & (BME280_OSRS_PRESS_SEL | BME280_OSRS_TEMP_SEL)) {
-		ret = set_osrs_press_temp_settings(self, desired_settings,
-						   settings);
-	}
+static ssize_t write_power_mode(struct bme280 *self, u8 sensor_mode)
+{
+	u8 reg_addr = BME280_CTRL_MEAS_ADDR;
+	u8 reg_data = build_ctrl_meas(&self->settings, sensor_mode);
 
-	return ret;
+	return bme280_set_regs(self, &reg_addr, &reg_data, 1);
 }
 
-static ssize_t
-set_filter_standby_time_settings(const struct bme280 *self, u8 desired_settings,
-				 const struct bme280_settings *settings)
+static ssize_t put_device_to_sleep(struct bme280 *self)
 {
 	ssize_t ret;
 
-	u8 reg_addr = BME280_CONFIG_ADDR;
-	union bme280_config config;
+	struct bme280_snapshot snapshot;
+
+	/** Forced conversion in flight is aborted, its data is never valid */
+	self->converting = false;
 
-	ret = bme280_get_regs(self, reg_addr, &config.reg, 1);
+	ret = bme280_get_snapshot(self, &snapshot);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
-	if (desired_settings & BME280_FILTER_SEL) {
-		config.filter = settings->filter;
-	}
-
-	if (desired_settings & BME280_STANDBY_TIME_SEL) {
-		config.t_sb = settings->standby_time;
-	}
-
-	ret = bme280_set_regs(self, &reg_addr, &config.reg, 1);
-
-err:
-	return ret;
-}
-
-static ssize_t reload_device_settings(const struct bme280 *self,
-				      const struct bme280_settings *settings)
-{
-	ssize_t ret;
-
-	ret = set_osrs_settings(self, BME280_ALL_SETTINGS_SEL, settings);
+	ret = bme280_soft_reset(self);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
-	ret = set_filter_standby_time_settings(self, BME280_ALL_SETTINGS_SEL,
-					       settings);
+	ret = write_device_settings(self, BME280_ALL_SETTINGS_SEL,
+				    &snapshot.settings);
 
 err:
 	return ret;
 }
 
-/********************** Device Power Control Functions ************************/
+/************************ Device Measurement Functions ************************/
 
-static ssize_t write_power_mode(const struct bme280 *self, u8 sensor_mode)
+static inline u8 osrs_to_factor(u8 osrs)
 {
-	ssize_t ret;
+	static const u8 factors[] = { 0, 1, 2, 4, 8, 16 };
 
-	u8 reg_addr = BME280_CTRL_MEAS_ADDR;
-	union bme280_ctrl_meas ctrl_meas;
-
-	ret = bme280_get_regs(self, reg_addr, &ctrl_meas.reg, 1);
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ctrl_meas.mode = sensor_mode;
-	ret = bme280_set_regs(self, &reg_addr, &ctrl_meas.reg, 1);
-
-err:
-	return ret;
+	return osrs < ARRAY_SIZE(factors) ? factors[osrs] : 16;
 }
 
-static ssize_t put_device_to_sleep(const struct bme280 *self)
+/**
+ * Polls snapshots until conversion is done, so the last snapshot already holds
+ * the data registers of the measurement
+ */
+static ssize_t wait_for_measurement(struct bme280 *self, u64 triggered,
+				    struct bme280_snapshot *snapshot)
 {
 	ssize_t ret;
 
-	union bme280_config config;
-	union bme280_ctrl_meas ctrl_meas;
-	union bme280_ctrl_hum ctrl_hum;
-	struct bme280_settings settings;
-
-	ret = bme280_get_regs(self, BME280_CTRL_HUM_ADDR, &ctrl_hum.reg, 1);
-	if (ret != BME280_OK) {
-		goto err;
+	union bme280_status status;
+	u32 meas_time;
+	u32 waited;
+
+	/**
+	 * Sleep through the rest of the conversion instead of polling the bus,
+	 * time passed since the trigger is not slept again
+	 */
+	meas_time = bme280_calc_meas_time(&self->settings);
+	waited = div_u64(ktime_get_ns() - triggered, NSEC_PER_USEC);
+	if (waited < meas_time) {
+		usleep_range(meas_time - waited,
+			     meas_time - waited + MEAS_POLL_INTERVAL_US);
+		waited = meas_time;
 	}
 
-	ret = bme280_get_regs(self, BME280_CTRL_MEAS_ADDR, &ctrl_meas.reg, 1);
-	if (ret != BME280_OK) {
-		goto err;
-	}
+	for (;;) {
+		ret = bme280_get_snapshot(self, snapshot);
+		if (ret != BME280_OK) {
+			goto err;
+		}
 
-	ret = bme280_get_regs(self, BME280_CONFIG_ADDR, &config.reg, 1);
-	if (ret != BME280_OK) {
-		goto err;
-	}
+		status.reg = snapshot->status;
+		atomic_inc(&self->stats->status_polls);
+		trace_bme280_meas_poll(self, waited, status.reg);
+		if (!status.measuring) {
+			break;
+		}
 
-	parse_device_settings(&config, &ctrl_meas, &ctrl_hum, &settings);
+		if (waited >= BME280_MEAS_TIMEOUT_US) {
+			ret = BME280_E_MEAS_TIMEOUT;
+			goto err;
+		}
 
-	ret = bme280_soft_reset(self);
-	if (ret != BME280_OK) {
-		goto err;
+		usleep_range(MEAS_POLL_INTERVAL_US, 2 * MEAS_POLL_INTERVAL_US);
+		waited += MEAS_POLL_INTERVAL_US;
 	}
 
-	ret = reload_device_settings(self, &settings);
+	bme280_hist_add(&self->stats->conversions, ktime_get_ns() - triggered);
 
 err:
+	if (trace_bme280_conversion_done_enabled()) {
+		trace_bme280_conversion_done(self, ktime_get_ns() - triggered,
+					     ret);
+	}
+
 	return ret;
 }
 
 /*********************** Data Compensation Functions **************************/
 
+/**
+ * Compensation formulas of the datasheet with calibration products taken from
+ * the context. Divisions of values which may be negative are kept, since an
+ * arithmetic shift rounds them down instead of towards zero
+ */
 static u32 compensate_pressure(const struct bme280_uncomp_data *uncomp_data,
-			       const struct bme280_calib_data *calib_data)
+			       const struct bme280_calib_data *calib_data,
+			       s32 t_fine)
 {
+	const struct bme280_comp_context *context = &calib_data->context;
+
 	s32 var1;
 	s32 var2;
 	s32 var3;
@@ -307,28 +475,29 @@ static u32 compensate_pressure(const struct bme280_uncomp_data *uncomp_data,
 	u32 var5;
 	u32 pressure;
 
-	var1 = (((s32)calib_data->t_fine) / 2) - (s32)64000;
-	var2 = (((var1 / 4) * (var1 / 4)) / 2048) * ((s32)calib_data->dig_P6);
-	var2 = var2 + ((var1 * ((s32)calib_data->dig_P5)) * 2);
-	var2 = (var2 / 4) + (((s32)calib_data->dig_P4) * 65536);
-	var3 = (calib_data->dig_P3 * (((var1 / 4) * (var1 / 4)) / 8192)) / 8;
+	var1 = (t_fine / 2) - (s32)64000;
+	var3 = (var1 / 4) * (var1 / 4);
+	var2 = (var3 / 2048) * ((s32)calib_data->dig_P6);
+	var2 = var2 + (var1 * context->p5_x2);
+	var2 = (var2 / 4) + context->p4_x65536;
+	var3 = (calib_data->dig_P3 * (var3 / 8192)) / 8;
 	var4 = (((s32)calib_data->dig_P2) * var1) / 2;
 	var1 = (var3 + var4) / 262144;
-	var1 = (((32768 + var1)) * ((s32)calib_data->dig_P1)) / 32768;
+	var1 = ((32768 + var1) * ((s32)calib_data->dig_P1)) / 32768;
 
 	if (var1) {
-		var5 = (u32)((u32)1048576) - uncomp_data->pressure;
+		var5 = (u32)1048576 - uncomp_data->pressure;
 		pressure = ((u32)(var5 - (u32)(var2 / 4096))) * 3125;
 		if (pressure < 0x80000000) {
 			pressure = (pressure << 1) / ((u32)var1);
 		} else {
-			pressure = (pressure / (u32)var1) * 2;
+			pressure = (pressure / (u32)var1) << 1;
 		}
 
 		var1 = (((s32)calib_data->dig_P9) *
-			((s32)(((pressure / 8) * (pressure / 8)) / 8192))) /
+			((s32)(((pressure >> 3) * (pressure >> 3)) >> 13))) /
 		       4096;
-		var2 = (((s32)(pressure / 4)) * ((s32)calib_data->dig_P8)) /
+		var2 = ((s32)(pressure >> 2) * ((s32)calib_data->dig_P8)) /
 		       8192;
 
 		pressure = (u32)((s32)pressure +
@@ -346,22 +515,65 @@ static u32 compensate_pressure(const struct bme280_uncomp_data *uncomp_data,
 	return pressure;
 }
 
+/**
+ * 64-bit formula of the datasheet, pressure is in Pa / 256. Division is 64-bit,
+ * which is a library call on 32-bit architectures
+ */
+static u32 compensate_pressure_64(const struct bme280_uncomp_data *uncomp_data,
+				  const struct bme280_calib_data *calib_data,
+				  s32 t_fine)
+{
+	const struct bme280_comp_context *context = &calib_data->context;
+
+	s64 var1;
+	s64 var2;
+	s64 pressure;
+
+	var1 = (s64)t_fine - 128000;
+	var2 = var1 * var1 * (s64)calib_data->dig_P6;
+	var2 = var2 + (var1 * (s64)calib_data->dig_P5) * 131072;
+	var2 = var2 + context->p4_x2_35;
+	var1 = ((var1 * var1 * (s64)calib_data->dig_P3) >> 8) +
+	       (var1 * (s64)calib_data->dig_P2) * 4096;
+	var1 = ((((s64)1 << 47) + var1) * (s64)calib_data->dig_P1) >> 33;
+
+	if (var1 == 0) {
+		return BME280_PRESS_MIN * PRESS_FINE_SCALE;
+	}
+
+	pressure = 1048576 - (s64)uncomp_data->pressure;
+	pressure = div64_s64((pressure * 2147483648LL - var2) * 3125, var1);
+	var1 = ((s64)calib_data->dig_P9 * (pressure >> 13) *
+		(pressure >> 13)) >> 25;
+	var2 = ((s64)calib_data->dig_P8 * pressure) >> 19;
+	pressure = ((pressure + var1 + var2) >> 8) +
+		   (s64)calib_data->dig_P7 * 16;
+
+	return clamp_t(s64, pressure, BME280_PRESS_MIN * PRESS_FINE_SCALE,
+		       BME280_PRESS_MAX * PRESS_FINE_SCALE);
+}
+
+/**
+ * Temperature with high resolution is returned in t_fine, pressure and humidity
+ * are compensated with it
+ */
 static s32 compensate_temperature(const struct bme280_uncomp_data *uncomp_data,
-				  struct bme280_calib_data *calib_data)
+				  const struct bme280_calib_data *calib_data,
+				  s32 *t_fine)
 {
+	const struct bme280_comp_context *context = &calib_data->context;
+
 	s32 var1;
 	s32 var2;
 	s32 temperature;
 
-	var1 = (s32)((uncomp_data->temperature / 8) -
-		     ((s32)calib_data->dig_T1 * 2));
+	var1 = (s32)(uncomp_data->temperature >> 3) - context->t1_x2;
 	var1 = (var1 * ((s32)calib_data->dig_T2)) / 2048;
-	var2 = (s32)((uncomp_data->temperature / 16) -
-		     ((s32)calib_data->dig_T1));
+	var2 = (s32)(uncomp_data->temperature >> 4) - context->t1;
 	var2 = (((var2 * var2) / 4096) * ((s32)calib_data->dig_T3)) / 16384;
 
-	calib_data->t_fine = var1 + var2;
-	temperature = (calib_data->t_fine * 5 + 128) / 256;
+	*t_fine = var1 + var2;
+	temperature = (*t_fine * 5 + 128) / 256;
 
 	if (temperature < BME280_TEMP_MIN) {
 		temperature = BME280_TEMP_MIN;
@@ -373,8 +585,11 @@ static s32 compensate_temperature(const struct bme280_uncomp_data *uncomp_data,
 }
 
 static u32 compensate_humidity(const struct bme280_uncomp_data *uncomp_data,
-			       const struct bme280_calib_data *calib_data)
+			       const struct bme280_calib_data *calib_data,
+			       s32 t_fine)
 {
+	const struct bme280_comp_context *context = &calib_data->context;
+
 	s32 var1;
 	s32 var2;
 	s32 var3;
@@ -382,11 +597,10 @@ static u32 compensate_humidity(const struct bme280_uncomp_data *uncomp_data,
 	s32 var5;
 	u32 humidity;
 
-	var1 = calib_data->t_fine - ((s32)76800);
-	var2 = (s32)(uncomp_data->humidity * 16384);
-	var3 = (s32)(((s32)calib_data->dig_H4) * 1048576);
+	var1 = t_fine - ((s32)76800);
+	var2 = (s32)(uncomp_data->humidity << 14);
 	var4 = ((s32)calib_data->dig_H5) * var1;
-	var5 = (((var2 - var3) - var4) + (s32)16384) / 32768;
+	var5 = ((var2 - var4) + context->h4_offset) / 32768;
 	var2 = (var1 * ((s32)calib_data->dig_H6)) / 1024;
 	var3 = (var1 * ((s32)calib_data->dig_H3)) / 2048;
 	var4 = ((var2 * (var3 + (s32)32768)) / 1024) + (s32)2097152;
@@ -397,7 +611,8 @@ static u32 compensate_humidity(const struct bme280_uncomp_data *uncomp_data,
 	var5 = (var5 < 0 ? 0 : var5);
 	var5 = (var5 > 419430400 ? 419430400 : var5);
 
-	humidity = (u32)(var5 / 4096);
+	/** Clamped to be non-negative, so it is shifted */
+	humidity = (u32)var5 >> 12;
 
 	if (humidity > BME280_HUM_MAX) {
 		humidity = BME280_HUM_MAX;
@@ -425,52 +640,113 @@ ssize_t bme280_init(struct bme280 *self, struct i2c_client *client)
 	i2c_set_clientdata(client, self);
 
 	self->client = client;
+	self->adapter = client->adapter;
+
+	self->regmap = regmap_init(&client->dev, &bme280_regmap_bus, self,
+				   &bme280_regmap_config);
+	if (IS_ERR(self->regmap)) {
+		ret = PTR_ERR(self->regmap);
+		self->regmap = NULL;
+		goto err;
+	}
 
 	ret = bme280_get_regs(self, BME280_CHIP_ID_ADDR, &self->chip_id, 1);
 	if (ret != BME280_OK) {
-		goto err;
+		goto exit_regmap;
 	}
 
 	ret = bme280_soft_reset(self);
 	if (ret != BME280_OK) {
-		goto err;
+		goto exit_regmap;
 	}
 
 	ret = get_calib_data(self);
+	if (ret != BME280_OK) {
+		goto exit_regmap;
+	}
 
+	return BME280_OK;
+
+exit_regmap:
+	bme280_deinit(self);
 err:
 	return ret;
 }
 
-ssize_t bme280_get_regs(const struct bme280 *self, u8 reg_addr, u8 *reg_data,
+void bme280_deinit(struct bme280 *self)
+{
+	if (self == NULL || self->regmap == NULL) {
+		return;
+	}
+
+	regmap_exit(self->regmap);
+	self->regmap = NULL;
+}
+
+bool bme280_is_volatile_reg(u8 reg_addr)
+{
+	switch (reg_addr) {
+	case BME280_CTRL_HUM_ADDR:
+	case BME280_CONFIG_ADDR:
+		return false;
+	default:
+		return true;
+	}
+}
+
+ssize_t bme280_get_regs(struct bme280 *self, u8 reg_addr, u8 *reg_data,
 			u8 len)
 {
 	ssize_t ret;
 
+	u32 cache_misses;
+	u64 start = 0;
+	u8 i;
+
 	ret = null_ptr_check(self);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
-	ret = i2c_smbus_read_i2c_block_data(self->client, reg_addr, len,
-					    reg_data);
-	if (ret <= 0) {
+	trace_bme280_get_regs_start(self, reg_addr, len);
+	if (trace_bme280_get_regs_end_enabled()) {
+		start = ktime_get_ns();
+	}
+
+	cache_misses = self->cache_misses;
+
+	ret = regmap_bulk_read(self->regmap, reg_addr, reg_data, len);
+	if (ret) {
 		ret = BME280_E_COMM_FAIL;
-		goto err;
+		goto trace_end;
 	}
 
-	return BME280_OK;
+	for (i = 0; i < len; i++) {
+		if (!bme280_is_volatile_reg(reg_addr + i)) {
+			self->cache_hits++;
+		}
+	}
+	self->cache_hits -= self->cache_misses - cache_misses;
 
+trace_end:
+	if (trace_bme280_get_regs_end_enabled()) {
+		trace_bme280_get_regs_end(self, reg_addr, len, ret,
+					  start ? ktime_get_ns() - start : 0);
+	}
 err:
 	return ret;
 }
 
-ssize_t bme280_set_regs(const struct bme280 *self, u8 *reg_addr,
+ssize_t bme280_set_regs(struct bme280 *self, u8 *reg_addr,
 			const u8 *reg_data, u8 len)
 {
 	ssize_t ret;
 
+	struct reg_sequence regs[BURST_WRITE_MAX_LEN];
+	u64 start = 0;
+	u8 burst_len;
 	u8 i;
+	u8 j;
 
 	ret = null_ptr_check(self);
 	if (ret != BME280_OK) {
@@ -487,57 +763,162 @@ ssize_t bme280_set_regs(const struct bme280 *self, u8 *reg_addr,
 		goto err;
 	}
 
-	for (i = 0; i < len; i++) {
-		ret = i2c_smbus_write_byte_data(self->client, reg_addr[i],
-						reg_data[i]);
+	trace_bme280_set_regs_start(self, reg_addr[0], len);
+	if (trace_bme280_set_regs_end_enabled()) {
+		start = ktime_get_ns();
+	}
+
+	for (i = 0; i < len; i += burst_len) {
+		burst_len = min_t(u8, len - i, BURST_WRITE_MAX_LEN);
+
+		for (j = 0; j < burst_len; j++) {
+			regs[j].reg = reg_addr[i + j];
+			regs[j].def = reg_data[i + j];
+			regs[j].delay_us = 0;
+		}
+
+		ret = regmap_multi_reg_write(self->regmap, regs, burst_len);
 		if (ret) {
 			ret = BME280_E_COMM_FAIL;
-			goto err;
+			goto trace_end;
 		}
 	}
 
-	return BME280_OK;
-
+trace_end:
+	if (trace_bme280_set_regs_end_enabled()) {
+		trace_bme280_set_regs_end(self, reg_addr[0], len, ret,
+					  start ? ktime_get_ns() - start : 0);
+	}
 err:
 	return ret;
 }
 
-ssize_t bme280_get_sensor_settings(struct bme280 *self)
+ssize_t bme280_get_snapshot(struct bme280 *self,
+			    struct bme280_snapshot *snapshot)
 {
 	ssize_t ret;
 
-	union bme280_config config;
-	union bme280_ctrl_meas ctrl_meas;
-	union bme280_ctrl_hum ctrl_hum;
+	u8 reg_data[BME280_SNAPSHOT_LEN];
 
 	ret = null_ptr_check(self);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
-	ret = bme280_get_regs(self, BME280_CTRL_HUM_ADDR, &ctrl_hum.reg, 1);
-	if (ret != BME280_OK) {
+	if (snapshot == NULL) {
+		ret = BME280_E_NULL_PTR;
 		goto err;
 	}
 
-	ret = bme280_get_regs(self, BME280_CTRL_MEAS_ADDR, &ctrl_meas.reg, 1);
-	if (ret != BME280_OK) {
+	/**
+	 * Range mixes cached and volatile registers, which regmap would split
+	 * into single register reads, so the device is read directly
+	 */
+	if (read_block(self, BME280_SNAPSHOT_ADDR, reg_data,
+		       BME280_SNAPSHOT_LEN)) {
+		ret = BME280_E_COMM_FAIL;
 		goto err;
 	}
 
-	ret = bme280_get_regs(self, BME280_CONFIG_ADDR, &config.reg, 1);
-	if (ret != BME280_OK) {
+	parse_snapshot(reg_data, snapshot);
+
+err:
+	return ret;
+}
+
+ssize_t bme280_get_snapshots(struct bme280 **devices, u8 count,
+			     struct bme280_snapshot *snapshots)
+{
+	ssize_t ret;
+
+	struct i2c_adapter *adapter;
+	struct i2c_client *client;
+	struct i2c_msg *msgs = NULL;
+	u8 *reg_data = NULL;
+	u8 i;
+
+	if ((devices == NULL) || (snapshots == NULL)) {
+		ret = BME280_E_NULL_PTR;
+		goto err;
+	}
+
+	if (count == 0) {
+		ret = BME280_E_INVALID_LEN;
 		goto err;
 	}
 
-	parse_device_settings(&config, &ctrl_meas, &ctrl_hum, &self->settings);
+	adapter = devices[0]->client->adapter;
+	if (!i2c_check_functionality(adapter, I2C_FUNC_I2C)) {
+		ret = BME280_E_COMM_FAIL;
+		goto err;
+	}
+
+	/** Buffers of messages must be DMA safe, so they are not on stack */
+	msgs = kmalloc_array(2 * count, sizeof(*msgs), GFP_KERNEL);
+	reg_data = kmalloc(1 + count * BME280_SNAPSHOT_LEN, GFP_KERNEL);
+	if ((msgs == NULL) || (reg_data == NULL)) {
+		ret = -ENOMEM;
+		goto free_buffers;
+	}
+
+	/** Register address is shared by write messages of all devices */
+	reg_data[0] = BME280_SNAPSHOT_ADDR;
+
+	for (i = 0; i < count; i++) {
+		client = devices[i]->client;
+
+		msgs[2 * i].addr = client->addr;
+		msgs[2 * i].flags = client->flags & I2C_M_TEN;
+		msgs[2 * i].len = 1;
+		msgs[2 * i].buf = reg_data;
 
+		msgs[2 * i + 1].addr = client->addr;
+		msgs[2 * i + 1].flags = (client->flags & I2C_M_TEN) | I2C_M_RD;
+		msgs[2 * i + 1].len = BME280_SNAPSHOT_LEN;
+		msgs[2 * i + 1].buf = &reg_data[1 + i * BME280_SNAPSHOT_LEN];
+	}
+
+	if (i2c_transfer(adapter, msgs, 2 * count) != 2 * count) {
+		for (i = 0; i < count; i++) {
+			atomic_inc(&devices[i]->stats->comm_errors);
+		}
+
+		ret = BME280_E_COMM_FAIL;
+		goto free_buffers;
+	}
+
+	for (i = 0; i < count; i++) {
+		atomic_inc(&devices[i]->stats->reads);
+		atomic64_add(BME280_SNAPSHOT_LEN,
+			     &devices[i]->stats->read_bytes);
+		parse_snapshot(&reg_data[1 + i * BME280_SNAPSHOT_LEN],
+			       &snapshots[i]);
+	}
+
+	ret = BME280_OK;
+
+free_buffers:
+	kfree(reg_data);
+	kfree(msgs);
 err:
 	return ret;
 }
 
-ssize_t bme280_set_sensor_settings(const struct bme280 *self,
-				   u8 desired_settings)
+ssize_t bme280_get_sensor_settings(struct bme280 *self)
+{
+	ssize_t ret;
+
+	struct bme280_snapshot snapshot;
+
+	ret = bme280_get_snapshot(self, &snapshot);
+	if (ret == BME280_OK) {
+		self->settings = snapshot.settings;
+	}
+
+	return ret;
+}
+
+ssize_t bme280_set_sensor_settings(struct bme280 *self, u8 desired_settings)
 {
 	ssize_t ret;
 
@@ -557,40 +938,30 @@ ssize_t bme280_set_sensor_settings(const struct bme280 *self,
 		goto err;
 	}
 
-	if (are_settings_changed(OVERSAMPLING_SETTINGS, desired_settings)) {
-		ret = set_osrs_settings(self, desired_settings,
-					&self->settings);
-	}
-
-	if ((ret == BME280_OK) &&
-	    are_settings_changed(FILTER_STANDBY_SETTINGS, desired_settings)) {
-		ret = set_filter_standby_time_settings(self, desired_settings,
-						       &self->settings);
-	}
+	ret = write_device_settings(self, desired_settings, &self->settings);
 
 err:
 	return ret;
 }
 
-ssize_t bme280_get_sensor_mode(const struct bme280 *self, u8 *sensor_mode)
+ssize_t bme280_get_sensor_mode(struct bme280 *self, u8 *sensor_mode)
 {
 	ssize_t ret;
 
-	union bme280_ctrl_meas ctrl_meas;
+	struct bme280_snapshot snapshot;
 
-	ret = null_ptr_check(self);
+	ret = bme280_get_snapshot(self, &snapshot);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
-	ret = bme280_get_regs(self, BME280_CTRL_MEAS_ADDR, &ctrl_meas.reg, 1);
-	*sensor_mode = ctrl_meas.mode;
+	*sensor_mode = snapshot.mode;
 
 err:
 	return ret;
 }
 
-ssize_t bme280_set_sensor_mode(const struct bme280 *self, u8 sensor_mode)
+ssize_t bme280_set_sensor_mode(struct bme280 *self, u8 sensor_mode)
 {
 	ssize_t ret;
 
@@ -615,7 +986,69 @@ err:
 	return ret;
 }
 
-ssize_t bme280_soft_reset(const struct bme280 *self)
+ssize_t bme280_trigger_forced_mode(struct bme280 *self)
+{
+	ssize_t ret;
+
+	u8 reg_addr = BME280_CTRL_MEAS_ADDR;
+	u8 reg_data;
+
+	ret = null_ptr_check(self);
+	if (ret != BME280_OK) {
+		goto err;
+	}
+
+	/**
+	 * Single write without reading the register back, this write also
+	 * latches pending ctrl_hum changes
+	 */
+	reg_data = build_ctrl_meas(&self->settings, BME280_FORCED_MODE);
+	ret = bme280_set_regs(self, &reg_addr, &reg_data, 1);
+	if (ret == BME280_OK) {
+		atomic_inc(&self->stats->forced_conversions);
+	}
+
+	if ((ret == BME280_OK) && trace_bme280_conversion_trigger_enabled()) {
+		trace_bme280_conversion_trigger(
+			self, bme280_calc_meas_time(&self->settings));
+	}
+
+err:
+	return ret;
+}
+
+u32 bme280_calc_meas_time(const struct bme280_settings *settings)
+{
+	u32 meas_time;
+
+	meas_time = BME280_MEAS_OFFSET_US;
+	meas_time += BME280_MEAS_DUR_US * osrs_to_factor(settings->osrs_t);
+
+	/** Skipped pressure and humidity take no time, offsets included */
+	if (settings->osrs_p != BME280_NO_OVERSAMPLING) {
+		meas_time += BME280_PRESS_HUM_MEAS_OFFSET_US;
+		meas_time +=
+			BME280_MEAS_DUR_US * osrs_to_factor(settings->osrs_p);
+	}
+
+	if (settings->osrs_h != BME280_NO_OVERSAMPLING) {
+		meas_time += BME280_PRESS_HUM_MEAS_OFFSET_US;
+		meas_time +=
+			BME280_MEAS_DUR_US * osrs_to_factor(settings->osrs_h);
+	}
+
+	return meas_time;
+}
+
+u32 bme280_calc_standby_time(const struct bme280_settings *settings)
+{
+	static const u32 standby_times[] = { 500,    62500,   125000, 250000,
+					     500000, 1000000, 10000,  20000 };
+
+	return standby_times[settings->standby_time & 0x07];
+}
+
+ssize_t bme280_soft_reset(struct bme280 *self)
 {
 	ssize_t ret;
 
@@ -629,11 +1062,23 @@ ssize_t bme280_soft_reset(const struct bme280 *self)
 		goto err;
 	}
 
+	/**
+	 * Data registers are back to their reset values, so a forced conversion
+	 * in flight must not be collected. Next request starts a new one
+	 */
+	self->converting = false;
+
 	ret = bme280_set_regs(self, &reg_addr, &soft_reset_command, 1);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
+	self->soft_resets++;
+
+	/** Settings registers are back to defaults, forget cached values */
+	regcache_drop_region(self->regmap, BME280_CTRL_HUM_ADDR,
+			     BME280_CONFIG_ADDR);
+
 	/* If NVM not copied yet, Wait for NVM to copy */
 	do {
 		/* As per data sheet - Table 1, startup time is 2 ms. */
@@ -643,6 +1088,7 @@ ssize_t bme280_soft_reset(const struct bme280 *self)
 		 (status_reg & BME280_STATUS_IM_UPDATE));
 
 	if (status_reg & BME280_STATUS_IM_UPDATE) {
+		atomic_inc(&self->stats->nvm_copy_failures);
 		ret = BME280_E_NVM_COPY_FAILED;
 		goto err;
 	}
@@ -681,35 +1127,68 @@ err:
 	return ret;
 }
 
-ssize_t bme280_get_sensor_data_forced(struct bme280 *self, u8 sensor_comp,
-				      struct bme280_data *comp_data)
+ssize_t bme280_get_snapshot_forced(struct bme280 *self,
+				   struct bme280_snapshot *snapshot)
 {
 	ssize_t ret;
 
-	union bme280_status status;
+	if (snapshot == NULL) {
+		ret = BME280_E_NULL_PTR;
+		goto err;
+	}
 
-	ret = bme280_set_sensor_mode(self, BME280_FORCED_MODE);
+	ret = bme280_trigger_forced_mode(self);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
-	ret = bme280_get_regs(self, BME280_STATUS_ADDR, &status.reg, 1);
+	ret = wait_for_measurement(self, ktime_get_ns(), snapshot);
+
+err:
+	return ret;
+}
+
+ssize_t bme280_get_snapshot_triggered(struct bme280 *self, u64 triggered,
+				      struct bme280_snapshot *snapshot)
+{
+	ssize_t ret;
+
+	ret = null_ptr_check(self);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
-	while (status.measuring) {
-		ret = bme280_get_regs(self, BME280_STATUS_ADDR, &status.reg, 1);
-		if (ret != BME280_OK) {
-			goto err;
-		}
+	if (snapshot == NULL) {
+		ret = BME280_E_NULL_PTR;
+		goto err;
 	}
 
-	ret = bme280_get_sensor_data(self, sensor_comp, comp_data);
+	ret = wait_for_measurement(self, triggered, snapshot);
+
+err:
+	return ret;
+}
+
+ssize_t bme280_get_sensor_data_forced(struct bme280 *self, u8 sensor_comp,
+				      struct bme280_data *comp_data)
+{
+	ssize_t ret;
+
+	struct bme280_snapshot snapshot;
+
+	if (comp_data == NULL) {
+		ret = BME280_E_NULL_PTR;
+		goto err;
+	}
+
+	ret = bme280_get_snapshot_forced(self, &snapshot);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
+	ret = bme280_compensate_data(sensor_comp, &snapshot.uncomp_data,
+				     comp_data, &self->calib_data);
+
 err:
 	return ret;
 }
@@ -739,10 +1218,12 @@ void bme280_parse_sensor_data(const u8 *reg_data,
 ssize_t bme280_compensate_data(u8 sensor_comp,
 			       const struct bme280_uncomp_data *uncomp_data,
 			       struct bme280_data *comp_data,
-			       struct bme280_calib_data *calib_data)
+			       const struct bme280_calib_data *calib_data)
 {
 	ssize_t ret;
 
+	s32 t_fine = 0;
+
 	if ((uncomp_data == NULL) && (comp_data == NULL) &&
 	    (calib_data == NULL)) {
 		ret = BME280_E_NULL_PTR;
@@ -751,23 +1232,35 @@ ssize_t bme280_compensate_data(u8 sensor_comp,
 
 	comp_data->temperature = 0;
 	comp_data->pressure = 0;
+	comp_data->pressure_fine = 0;
 	comp_data->humidity = 0;
 
 	if (sensor_comp & (BME280_PRESS | BME280_TEMP | BME280_HUM)) {
-		comp_data->temperature =
-			compensate_temperature(uncomp_data, calib_data);
+		comp_data->temperature = compensate_temperature(
+			uncomp_data, calib_data, &t_fine);
 	}
 
-	if (sensor_comp & BME280_PRESS) {
+	if ((sensor_comp & BME280_PRESS) &&
+	    (calib_data->context.press_precision ==
+	     BME280_PRESS_PRECISION_64)) {
+		comp_data->pressure_fine =
+			compensate_pressure_64(uncomp_data, calib_data, t_fine);
+		comp_data->pressure = DIV_ROUND_CLOSEST(
+			comp_data->pressure_fine, PRESS_FINE_SCALE);
+	} else if (sensor_comp & BME280_PRESS) {
 		comp_data->pressure =
-			compensate_pressure(uncomp_data, calib_data);
+			compensate_pressure(uncomp_data, calib_data, t_fine);
+		comp_data->pressure_fine =
+			comp_data->pressure * PRESS_FINE_SCALE;
 	}
 
 	if (sensor_comp & BME280_HUM) {
 		comp_data->humidity =
-			compensate_humidity(uncomp_data, calib_data);
+			compensate_humidity(uncomp_data, calib_data, t_fine);
 	}
 
+	trace_bme280_compensate(sensor_comp, uncomp_data, comp_data);
+
 	return BME280_OK;
 
 err:
@@ -0,0 +1,276 @@
+#include <linux/compat.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/miscdevice.h>
+#include <linux/slab.h>
+#include <linux/stat.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/rcupdate.h>
+#include <linux/timekeeping.h>
+
+#include <module.h>
+#include <bme280.h>
+#include <bme280_sampler.h>
+#include <bme280_ctl_mapp.h>
+
+/***************************** Extern Variables *******************************/
+
+extern struct list_head bme280_devices;
+
+/***************************** Common Functions *******************************/
+
+/** Must be called under RCU read lock */
+static struct bme280 *find_device(u32 adapter, u32 address)
+{
+	struct bme280 *device;
+
+	list_for_each_entry_rcu (device, &bme280_devices, registered) {
+		if ((device->client->adapter->nr == adapter) &&
+		    (device->client->addr == address)) {
+			return device;
+		}
+	}
+
+	return NULL;
+}
+
+/** Input records select devices, fields but adapter and address are ignored */
+static void clear_record(struct bme280_batch_record *record)
+{
+	u32 adapter = record->adapter;
+	u32 address = record->address;
+
+	memset(record, 0, sizeof(*record));
+	record->adapter = adapter;
+	record->address = address;
+}
+
+static void fill_record(struct bme280_batch_record *record,
+			const struct bme280_sample *sample, u32 channels)
+{
+	record->timestamp = sample->timestamp;
+
+	if (channels & BME280_BATCH_PRESS) {
+		record->uncomp_pressure = sample->uncomp_data.pressure;
+		record->pressure = sample->comp_data.pressure;
+	}
+
+	if (channels & BME280_BATCH_TEMP) {
+		record->uncomp_temperature = sample->uncomp_data.temperature;
+		record->temperature = sample->comp_data.temperature;
+	}
+
+	if (channels & BME280_BATCH_HUM) {
+		record->uncomp_humidity = sample->uncomp_data.humidity;
+		record->humidity = sample->comp_data.humidity;
+	}
+}
+
+/**
+ * Takes references of devices selected by the batch, so they outlive removal
+ * while they are read. Records of devices which are not registered get an
+ * error, count is the number of devices of the batch
+ */
+static long get_batch_devices(const struct bme280_batch *batch,
+			      struct bme280_batch_record *records,
+			      struct bme280 **devices, u32 *count)
+{
+	long ret = 0;
+
+	struct bme280 *device;
+	u32 i = 0;
+
+	rcu_read_lock();
+
+	if (batch->flags & BME280_BATCH_ALL_DEVICES) {
+		list_for_each_entry_rcu (device, &bme280_devices, registered) {
+			if (i < batch->count) {
+				bme280_get_device(device);
+				devices[i] = device;
+				records[i].adapter =
+					device->client->adapter->nr;
+				records[i].address = device->client->addr;
+			}
+
+			i++;
+		}
+
+		if (i > batch->count) {
+			ret = -ENOSPC;
+		}
+	} else {
+		for (i = 0; i < batch->count; i++) {
+			devices[i] = find_device(records[i].adapter,
+						 records[i].address);
+			if (devices[i] != NULL) {
+				bme280_get_device(devices[i]);
+			} else {
+				records[i].error = -ENODEV;
+			}
+		}
+	}
+
+	rcu_read_unlock();
+
+	*count = i;
+
+	return ret;
+}
+
+/****************************** Batch Read ************************************/
+
+static long ctl_batch_read(struct bme280_batch __user *ubatch)
+{
+	long ret;
+
+	struct bme280_batch batch;
+	struct bme280_batch_record *records = NULL;
+	struct bme280 **devices = NULL;
+	struct bme280_sample *samples = NULL;
+	ssize_t *results = NULL;
+	u64 arrival = ktime_get_ns();
+	u32 count = 0;
+	u32 i;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch))) {
+		ret = -EFAULT;
+		goto err;
+	}
+
+	if ((batch.flags & ~BME280_BATCH_ALL_DEVICES) ||
+	    (batch.channels == 0) ||
+	    (batch.channels & ~BME280_BATCH_ALL_CHANNELS) ||
+	    (batch.count > BME280_BATCH_MAX_RECORDS) || batch.reserved) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	records = kcalloc(batch.count, sizeof(*records), GFP_KERNEL);
+	devices = kcalloc(batch.count, sizeof(*devices), GFP_KERNEL);
+	samples = kcalloc(batch.count, sizeof(*samples), GFP_KERNEL);
+	results = kcalloc(batch.count, sizeof(*results), GFP_KERNEL);
+	if ((records == NULL) || (devices == NULL) || (samples == NULL) ||
+	    (results == NULL)) {
+		ret = -ENOMEM;
+		goto free_buffers;
+	}
+
+	if (!(batch.flags & BME280_BATCH_ALL_DEVICES)) {
+		if (copy_from_user(records, u64_to_user_ptr(batch.records),
+				   batch.count * sizeof(*records))) {
+			ret = -EFAULT;
+			goto free_buffers;
+		}
+
+		for (i = 0; i < batch.count; i++) {
+			clear_record(&records[i]);
+		}
+	}
+
+	ret = get_batch_devices(&batch, records, devices, &count);
+	if (ret) {
+		goto copy_count;
+	}
+
+	/** Conversions of all devices run in parallel */
+	bme280_sample_devices(devices, count, batch.channels, arrival, samples,
+			      results);
+
+	for (i = 0; i < count; i++) {
+		if (results[i] == -ENODEV) {
+			records[i].error = -ENODEV;
+		} else if (results[i] != BME280_OK) {
+			records[i].error = -EIO;
+		} else {
+			fill_record(&records[i], &samples[i], batch.channels);
+		}
+	}
+
+	if (copy_to_user(u64_to_user_ptr(batch.records), records,
+			 count * sizeof(*records))) {
+		ret = -EFAULT;
+		goto put_devices;
+	}
+
+copy_count:
+	if (put_user(count, &ubatch->count)) {
+		ret = -EFAULT;
+	}
+
+put_devices:
+	for (i = 0; i < batch.count; i++) {
+		if (devices[i] != NULL) {
+			bme280_put_device(devices[i]);
+		}
+	}
+
+free_buffers:
+	kfree(results);
+	kfree(samples);
+	kfree(devices);
+	kfree(records);
+err:
+	return ret;
+}
+
+/***************************** Control Device *********************************/
+
+static long ctl_file_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	switch (cmd) {
+	case BME280_IOC_BATCH_READ:
+		return ctl_batch_read((struct bme280_batch __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+#ifdef CONFIG_COMPAT
+/** Layout of the argument is the same, only its pointer is converted */
+static long ctl_file_compat_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	return ctl_file_ioctl(file, cmd, (unsigned long)compat_ptr(arg));
+}
+#endif /* CONFIG_COMPAT */
+
+static const struct file_operations ctl_file_ops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = &ctl_file_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl = &ctl_file_compat_ioctl,
+#endif /* CONFIG_COMPAT */
+	.llseek = &no_llseek
+};
+
+static struct miscdevice ctl_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = THIS_MODULE_NAME,
+	.fops = &ctl_file_ops,
+	.mode = S_IRUGO
+};
+
+/***************************** Public Functions *******************************/
+
+ssize_t bme280_create_ctl_mapp(void)
+{
+	ssize_t ret;
+
+	ret = misc_register(&ctl_misc);
+	if (ret) {
+		pr_err(THIS_MODULE_NAME ": failed to register control device"
+					" '/dev/%s'\n",
+		       THIS_MODULE_NAME);
+	}
+
+	return ret;
+}
+
+void bme280_remove_ctl_mapp(void)
+{
+	misc_deregister(&ctl_misc);
+}
@@ -0,0 +1,324 @@
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/stat.h>
+#include <linux/list.h>
+
+#include <module.h>
+#include <bme280.h>
+#include <bme280_debug_mapp.h>
+
+/***************************** Extern Variables *******************************/
+
+extern struct bme280_lock_stats bme280_devices_lock_stats[BME280_ENTRY_MAX];
+
+/****************************** Debugfs Utils *********************************/
+
+#define DEBUG_DIR(name) struct dentry *debug_dir_##name = NULL
+
+#define DEBUG_ENTRY_NAME(name) #name,
+
+static const char *const debug_entry_names[] = {
+	BME280_ENTRY_POINTS(DEBUG_ENTRY_NAME)
+};
+
+static bool debug_hist_is_empty(const struct bme280_hist *hist)
+{
+	u8 i;
+
+	for (i = 0; i < BME280_HIST_BUCKETS; i++) {
+		if (atomic64_read(&hist->buckets[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Histogram per line, columns are counts of latencies below 1, 2, 4 and so on
+ * microseconds, the last column counts all longer latencies
+ */
+static void debug_show_hist(struct seq_file *s, const char *name,
+			    const struct bme280_hist *hist)
+{
+	u8 i;
+
+	seq_printf(s, "%-24s :", name);
+
+	for (i = 0; i < BME280_HIST_BUCKETS; i++) {
+		seq_printf(s, " %lld", atomic64_read(&hist->buckets[i]));
+	}
+
+	seq_putc(s, '\n');
+}
+
+static void debug_reset_hist(struct bme280_hist *hist)
+{
+	u8 i;
+
+	for (i = 0; i < BME280_HIST_BUCKETS; i++) {
+		atomic64_set(&hist->buckets[i], 0);
+	}
+}
+
+/******************************* Debugfs Dirs *********************************/
+
+#define DEBUG_DIR_BME280 "bme280"
+
+static DEBUG_DIR(bme280);
+
+/********************** Device register cache (Debugfs) ***********************/
+
+static int debug_file_regcache_show(struct seq_file *s, void *data)
+{
+	struct bme280 *device = s->private;
+
+	unsigned int reg_data;
+	u8 reg_addr;
+
+	bme280_lock_device(device, BME280_ENTRY_regcache);
+
+	/** Cache only mode makes uncached registers fail instead of reading */
+	regcache_cache_only(device->regmap, true);
+
+	for (reg_addr = BME280_CTRL_HUM_ADDR; reg_addr <= BME280_CONFIG_ADDR;
+	     reg_addr++) {
+		if (bme280_is_volatile_reg(reg_addr)) {
+			continue;
+		}
+
+		if (regmap_read(device->regmap, reg_addr, &reg_data)) {
+			seq_printf(s, "0x%02x: --\n", reg_addr);
+		} else {
+			seq_printf(s, "0x%02x: 0x%02x\n", reg_addr, reg_data);
+		}
+	}
+
+	regcache_cache_only(device->regmap, false);
+
+	bme280_unlock_device(device);
+
+	return 0;
+}
+
+static int debug_file_regcache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &debug_file_regcache_show, inode->i_private);
+}
+
+static const struct file_operations debug_file_regcache_ops = {
+	.owner = THIS_MODULE,
+	.open = &debug_file_regcache_open,
+	.read = &seq_read,
+	.llseek = &seq_lseek,
+	.release = &single_release
+};
+
+/************************ Device statistics (Debugfs) *************************/
+
+/** Counters are atomics, so they are read without lock of the device */
+static int debug_file_stats_show(struct seq_file *s, void *data)
+{
+	struct bme280 *device = s->private;
+	struct bme280_stats *stats = device->stats;
+
+	seq_printf(s,
+		   "Reads                    : %d\n"
+		   "Writes                   : %d\n"
+		   "Read Bytes               : %lld\n"
+		   "Written Bytes            : %lld\n"
+		   "Communication Errors     : %d\n"
+		   "Soft Resets              : %u\n"
+		   "NVM Copy Failures        : %d\n"
+		   "Forced Conversions       : %d\n"
+		   "Status Polls             : %d\n",
+		   atomic_read(&stats->reads), atomic_read(&stats->writes),
+		   atomic64_read(&stats->read_bytes),
+		   atomic64_read(&stats->write_bytes),
+		   atomic_read(&stats->comm_errors),
+		   READ_ONCE(device->soft_resets),
+		   atomic_read(&stats->nvm_copy_failures),
+		   atomic_read(&stats->forced_conversions),
+		   atomic_read(&stats->status_polls));
+
+	return 0;
+}
+
+static int debug_file_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &debug_file_stats_show, inode->i_private);
+}
+
+static const struct file_operations debug_file_stats_ops = {
+	.owner = THIS_MODULE,
+	.open = &debug_file_stats_open,
+	.read = &seq_read,
+	.llseek = &seq_lseek,
+	.release = &single_release
+};
+
+/********************** Device latencies (Debugfs) ****************************/
+
+/** Entry points which were never requested are omitted */
+static int debug_file_latency_show(struct seq_file *s, void *data)
+{
+	struct bme280 *device = s->private;
+	u8 i;
+
+	debug_show_hist(s, "conversion", &device->stats->conversions);
+
+	for (i = 0; i < BME280_ENTRY_MAX; i++) {
+		if (!debug_hist_is_empty(&device->stats->entries[i])) {
+			debug_show_hist(s, debug_entry_names[i],
+					&device->stats->entries[i]);
+		}
+	}
+
+	return 0;
+}
+
+static int debug_file_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &debug_file_latency_show, inode->i_private);
+}
+
+static const struct file_operations debug_file_latency_ops = {
+	.owner = THIS_MODULE,
+	.open = &debug_file_latency_open,
+	.read = &seq_read,
+	.llseek = &seq_lseek,
+	.release = &single_release
+};
+
+/****************** Lock wait and hold times (Debugfs) ************************/
+
+/**
+ * Line of count, sums and maximums of waits and hold times in nanoseconds per
+ * entry point which took the lock, followed by histograms of them. Statistics
+ * are the private data of the file, registry and devices share the format
+ */
+static int debug_file_lock_show(struct seq_file *s, void *data)
+{
+	struct bme280_lock_stats *stats = s->private;
+	u8 i;
+
+	for (i = 0; i < BME280_ENTRY_MAX; i++) {
+		if (atomic_read(&stats[i].count) == 0) {
+			continue;
+		}
+
+		seq_printf(s, "%-24s : %d %lld %lld %lld %lld\n",
+			   debug_entry_names[i], atomic_read(&stats[i].count),
+			   atomic64_read(&stats[i].wait_sum),
+			   atomic64_read(&stats[i].wait_max),
+			   atomic64_read(&stats[i].hold_sum),
+			   atomic64_read(&stats[i].hold_max));
+		debug_show_hist(s, "  wait", &stats[i].wait);
+		debug_show_hist(s, "  hold", &stats[i].hold);
+	}
+
+	return 0;
+}
+
+static int debug_file_lock_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, &debug_file_lock_show, inode->i_private);
+}
+
+/** Any write resets statistics, concurrent updates may survive it */
+static ssize_t debug_file_lock_write(struct file *file,
+				     const char __user *ubuf, size_t count,
+				     loff_t *off)
+{
+	struct seq_file *s = file->private_data;
+	struct bme280_lock_stats *stats = s->private;
+	u8 i;
+
+	for (i = 0; i < BME280_ENTRY_MAX; i++) {
+		atomic_set(&stats[i].count, 0);
+		atomic64_set(&stats[i].wait_sum, 0);
+		atomic64_set(&stats[i].wait_max, 0);
+		atomic64_set(&stats[i].hold_sum, 0);
+		atomic64_set(&stats[i].hold_max, 0);
+		debug_reset_hist(&stats[i].wait);
+		debug_reset_hist(&stats[i].hold);
+	}
+
+	return count;
+}
+
+static const struct file_operations debug_file_lock_ops = {
+	.owner = THIS_MODULE,
+	.open = &debug_file_lock_open,
+	.read = &seq_read,
+	.write = &debug_file_lock_write,
+	.llseek = &seq_lseek,
+	.release = &single_release
+};
+
+/***************************** Public Functions *******************************/
+
+void bme280_create_debug_mapp(void)
+{
+	debug_dir_bme280 = debugfs_create_dir(DEBUG_DIR_BME280, NULL);
+	if (IS_ERR_OR_NULL(debug_dir_bme280)) {
+		pr_warn(THIS_MODULE_NAME ": failed to create directory"
+					 " '%s' in debugfs\n",
+			DEBUG_DIR_BME280);
+
+		debug_dir_bme280 = NULL;
+		return;
+	}
+
+	debugfs_create_file("devices_lock", S_IRUSR | S_IWUSR,
+			    debug_dir_bme280, bme280_devices_lock_stats,
+			    &debug_file_lock_ops);
+}
+
+void bme280_remove_debug_mapp(void)
+{
+	debugfs_remove_recursive(debug_dir_bme280);
+	debug_dir_bme280 = NULL;
+}
+
+void bme280_attach_debug_mapp(struct bme280 *device)
+{
+	const char *name = dev_name(&device->client->dev);
+
+	if (debug_dir_bme280 == NULL) {
+		return;
+	}
+
+	device->debugfs = debugfs_create_dir(name, debug_dir_bme280);
+	if (IS_ERR_OR_NULL(device->debugfs)) {
+		pr_warn(THIS_MODULE_NAME ": failed to create directory"
+					 " '%s/%s' in debugfs\n",
+			DEBUG_DIR_BME280, name);
+
+		device->debugfs = NULL;
+		return;
+	}
+
+	debugfs_create_file("regcache", S_IRUSR, device->debugfs, device,
+			    &debug_file_regcache_ops);
+	debugfs_create_u32("cache_hits", S_IRUSR, device->debugfs,
+			   &device->cache_hits);
+	debugfs_create_u32("cache_misses", S_IRUSR, device->debugfs,
+			   &device->cache_misses);
+	debugfs_create_file("stats", S_IRUSR, device->debugfs, device,
+			    &debug_file_stats_ops);
+	debugfs_create_file("latency", S_IRUSR, device->debugfs, device,
+			    &debug_file_latency_ops);
+	debugfs_create_file("lock", S_IRUSR | S_IWUSR, device->debugfs,
+			    device->stats->locks, &debug_file_lock_ops);
+}
+
+void bme280_detach_debug_mapp(struct bme280 *device)
+{
+	if (device == NULL) {
+		return;
+	}
+
+	debugfs_remove_recursive(device->debugfs);
+	device->debugfs = NULL;
+}
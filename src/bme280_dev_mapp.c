@@ -0,0 +1,622 @@
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/idr.h>
+#include <linux/kfifo.h>
+#include <linux/stat.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/rcupdate.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/timekeeping.h>
+
+#include <module.h>
+#include <bme280.h>
+#include <bme280_sampler.h>
+#include <bme280_dev_mapp.h>
+
+#define BME280_DEV_MINORS 256
+
+/***************************** Extern Variables *******************************/
+
+extern struct class *class_bme280;
+extern const struct attribute_group bme280_regs_attr_group;
+
+extern struct list_head bme280_devices;
+
+/***************************** Global Variables *******************************/
+
+static dev_t bme280_devt;
+static DEFINE_IDA(bme280_minors);
+
+/** Attributes of regs mapping which are notified about new samples */
+static const char *const notify_attrs[BME280_NOTIFY_ATTRS] = {
+	"pressure", "temperature", "humidity", "measurements"
+};
+
+/***************************** Common Functions *******************************/
+
+/** Must be called under RCU read lock */
+static struct bme280 *find_device(dev_t devt)
+{
+	struct bme280 *device;
+
+	list_for_each_entry_rcu (device, &bme280_devices, registered) {
+		if (device->devt == devt) {
+			return device;
+		}
+	}
+
+	return NULL;
+}
+
+/******************************* Sysfs Utils **********************************/
+
+#define DEV_ATTR(name, mode, show, store)                                      \
+	struct device_attribute dev_attr_##name =                              \
+		__ATTR(name, mode, show, store)
+#define DEV_ATTR_RW(name, show, store)                                         \
+	DEV_ATTR(name, S_IRUGO | S_IWUSR, show, store)
+#define DEV_ATTR_RO(name, show) DEV_ATTR(name, S_IRUGO, show, NULL)
+
+/*********************** Ring of samples (Sysfs) ******************************/
+
+static ssize_t dev_attr_ring_depth_show(struct device *dev,
+					struct device_attribute *attr,
+					char *buf)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	u64 arrival = ktime_get_ns();
+
+	bme280_lock_device(device, BME280_ENTRY_ring_depth_show);
+	ret = sprintf(buf, "%u\n", kfifo_size(&device->ring));
+	bme280_stats_entry(device->stats, BME280_ENTRY_ring_depth_show,
+			   arrival);
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static ssize_t dev_attr_ring_depth_store(struct device *dev,
+					 struct device_attribute *attr,
+					 const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	u32 depth;
+	u64 arrival = ktime_get_ns();
+
+	ret = kstrtouint(buf, 10, &depth);
+	if (ret) {
+		pr_err(THIS_MODULE_NAME ": invalid argument, try to write"
+					" ring depth in decimal\n");
+
+		return -EINVAL;
+	}
+
+	bme280_lock_device(device, BME280_ENTRY_ring_depth_store);
+
+	ret = bme280_set_ring_depth(device, depth);
+	if (ret) {
+		goto err;
+	}
+
+	ret = count;
+
+err:
+	bme280_stats_entry(device->stats, BME280_ENTRY_ring_depth_store,
+			   arrival);
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static ssize_t dev_attr_watermark_show(struct device *dev,
+				       struct device_attribute *attr, char *buf)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	u64 arrival = ktime_get_ns();
+
+	bme280_lock_device(device, BME280_ENTRY_watermark_show);
+	ret = sprintf(buf, "%u\n", device->watermark);
+	bme280_stats_entry(device->stats, BME280_ENTRY_watermark_show, arrival);
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static ssize_t dev_attr_watermark_store(struct device *dev,
+					struct device_attribute *attr,
+					const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	u32 watermark;
+	u64 arrival = ktime_get_ns();
+
+	ret = kstrtouint(buf, 10, &watermark);
+	if (ret) {
+		pr_err(THIS_MODULE_NAME ": invalid argument, try to write"
+					" watermark in decimal\n");
+
+		return -EINVAL;
+	}
+
+	bme280_lock_device(device, BME280_ENTRY_watermark_store);
+
+	if ((watermark == 0) || (watermark > kfifo_size(&device->ring))) {
+		pr_err(THIS_MODULE_NAME ": wrong watermark, acceptable values"
+					" (1..%u)\n",
+		       kfifo_size(&device->ring));
+
+		ret = -EINVAL;
+		goto err;
+	}
+
+	device->watermark = watermark;
+	ret = count;
+
+err:
+	bme280_stats_entry(device->stats, BME280_ENTRY_watermark_store,
+			   arrival);
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static ssize_t dev_attr_dropped_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	u64 arrival = ktime_get_ns();
+
+	bme280_lock_device(device, BME280_ENTRY_dropped_show);
+	ret = sprintf(buf, "%u\n", device->dropped);
+	bme280_stats_entry(device->stats, BME280_ENTRY_dropped_show, arrival);
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static DEV_ATTR_RW(ring_depth, &dev_attr_ring_depth_show,
+		   &dev_attr_ring_depth_store);
+static DEV_ATTR_RW(watermark, &dev_attr_watermark_show,
+		   &dev_attr_watermark_store);
+static DEV_ATTR_RO(dropped, &dev_attr_dropped_show);
+
+/*********************** Forced sampling (Sysfs) ******************************/
+
+static ssize_t dev_attr_pipeline_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	u64 arrival = ktime_get_ns();
+
+	bme280_lock_device(device, BME280_ENTRY_pipeline_show);
+	ret = sprintf(buf, "%u\n", device->pipeline);
+	bme280_stats_entry(device->stats, BME280_ENTRY_pipeline_show, arrival);
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static ssize_t dev_attr_pipeline_store(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	u32 pipeline;
+	u64 arrival = ktime_get_ns();
+
+	ret = kstrtouint(buf, 10, &pipeline);
+	if (ret) {
+		pr_err(THIS_MODULE_NAME ": invalid argument, try to write"
+					" staleness bound in milliseconds in"
+					" decimal\n");
+
+		return -EINVAL;
+	}
+
+	bme280_lock_device(device, BME280_ENTRY_pipeline_store);
+	device->pipeline = pipeline;
+	bme280_stats_entry(device->stats, BME280_ENTRY_pipeline_store, arrival);
+	bme280_unlock_device(device);
+
+	return count;
+}
+
+static DEV_ATTR_RW(pipeline, &dev_attr_pipeline_show,
+		   &dev_attr_pipeline_store);
+
+/************************* Compensation (Sysfs) *******************************/
+
+static ssize_t dev_attr_pressure_precision_show(struct device *dev,
+						struct device_attribute *attr,
+						char *buf)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	u64 arrival = ktime_get_ns();
+
+	bme280_lock_device(device, BME280_ENTRY_pressure_precision_show);
+	ret = sprintf(buf, "%u\n", device->calib_data.context.press_precision);
+	bme280_stats_entry(device->stats, BME280_ENTRY_pressure_precision_show,
+			   arrival);
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static ssize_t dev_attr_pressure_precision_store(struct device *dev,
+						 struct device_attribute *attr,
+						 const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	u32 precision;
+	u64 arrival = ktime_get_ns();
+
+	ret = kstrtouint(buf, 10, &precision);
+	if (ret || ((precision != BME280_PRESS_PRECISION_32) &&
+		    (precision != BME280_PRESS_PRECISION_64))) {
+		pr_err(THIS_MODULE_NAME ": invalid argument, try to write"
+					" 32 or 64\n");
+
+		return -EINVAL;
+	}
+
+	bme280_lock_device(device, BME280_ENTRY_pressure_precision_store);
+	device->calib_data.context.press_precision = precision;
+	bme280_stats_entry(device->stats,
+			   BME280_ENTRY_pressure_precision_store, arrival);
+	bme280_unlock_device(device);
+
+	return count;
+}
+
+static ssize_t dev_attr_pressure_fine_show(struct device *dev,
+					   struct device_attribute *attr,
+					   char *buf)
+{
+	ssize_t ret;
+
+	struct bme280 *device = dev_get_drvdata(dev);
+	struct bme280_calib_data calib_data;
+	struct bme280_sample sample;
+	u64 arrival = ktime_get_ns();
+
+	bme280_lock_device(device, BME280_ENTRY_pressure_fine_show);
+	ret = bme280_get_raw_sample(device, arrival, &sample, &calib_data);
+	bme280_stats_entry(device->stats, BME280_ENTRY_pressure_fine_show,
+			   arrival);
+	bme280_unlock_device(device);
+
+	if (ret != BME280_OK) {
+		pr_err(THIS_MODULE_NAME
+		       ": failed to get pressure from sesnsor, try again"
+		       " later\n");
+
+		return -EAGAIN;
+	}
+
+	bme280_compensate_data(BME280_PRESS, &sample.uncomp_data,
+			       &sample.comp_data, &calib_data);
+
+	return sprintf(buf, "%u\n", sample.comp_data.pressure_fine);
+}
+
+static DEV_ATTR_RW(pressure_precision, &dev_attr_pressure_precision_show,
+		   &dev_attr_pressure_precision_store);
+static DEV_ATTR_RO(pressure_fine, &dev_attr_pressure_fine_show);
+
+static struct attribute *dev_attrs[] = {
+	&dev_attr_ring_depth.attr, &dev_attr_watermark.attr,
+	&dev_attr_dropped.attr, &dev_attr_pipeline.attr,
+	&dev_attr_pressure_precision.attr, &dev_attr_pressure_fine.attr, NULL
+};
+static const struct attribute_group dev_attr_group = { .attrs = dev_attrs };
+
+/** Registers, calibration data and measurements come from regs mapping */
+static const struct attribute_group *dev_attr_groups[] = {
+	&dev_attr_group, &bme280_regs_attr_group, NULL
+};
+
+/******************** Ring of samples (Character device) **********************/
+
+static int dev_file_open(struct inode *inode, struct file *file)
+{
+	struct bme280 *device;
+
+	rcu_read_lock();
+
+	/** Open files keep a reference, device outlives its removal */
+	device = find_device(inode->i_rdev);
+	if (device != NULL) {
+		bme280_get_device(device);
+	}
+
+	rcu_read_unlock();
+
+	if (device == NULL) {
+		return -ENODEV;
+	}
+
+	file->private_data = device;
+
+	return nonseekable_open(inode, file);
+}
+
+static int dev_file_release(struct inode *inode, struct file *file)
+{
+	bme280_put_device(file->private_data);
+
+	return 0;
+}
+
+/**
+ * Ring is filled by the sampler only, so without it a blocking reader drains
+ * what is left instead of waiting for the watermark
+ */
+static inline u32 ring_threshold(const struct bme280 *device,
+				 const struct file *file)
+{
+	return ((file->f_flags & O_NONBLOCK) || !device->sampling) ?
+		       1 :
+		       device->watermark;
+}
+
+static ssize_t dev_file_read(struct file *file, char __user *ubuf,
+			     size_t count, loff_t *off)
+{
+	ssize_t ret;
+
+	struct bme280 *device = file->private_data;
+	unsigned int copied;
+	int generation;
+
+	if (count < sizeof(struct bme280_record)) {
+		return -EINVAL;
+	}
+
+	for (;;) {
+		generation = atomic_read(&device->samples_generation);
+
+		bme280_lock_device(device, BME280_ENTRY_chardev_read);
+
+		/** Character device of the device is removed */
+		if (device->devt == 0) {
+			ret = -ENODEV;
+			goto err;
+		}
+
+		/** Blocking readers wait for watermark of samples */
+		if (kfifo_len(&device->ring) >= ring_threshold(device, file)) {
+			/** Only whole records are copied */
+			ret = kfifo_to_user(&device->ring, ubuf, count,
+					    &copied);
+			if (ret == 0) {
+				ret = copied;
+			}
+
+			goto err;
+		}
+
+		/** Forced and sleep modes never fill the ring */
+		if (!device->sampling) {
+			ret = -ENODATA;
+			goto err;
+		}
+
+		bme280_unlock_device(device);
+
+		if (file->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+
+		ret = wait_event_interruptible(
+			device->samples_wait,
+			atomic_read(&device->samples_generation) != generation);
+		if (ret) {
+			return ret;
+		}
+	}
+
+err:
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static __poll_t dev_file_poll(struct file *file, poll_table *wait)
+{
+	__poll_t ret = 0;
+
+	struct bme280 *device = file->private_data;
+
+	poll_wait(file, &device->samples_wait, wait);
+
+	bme280_lock_device(device, BME280_ENTRY_chardev_poll);
+
+	/** Samples left after the sampler stopped are readable until drained */
+	if (device->devt == 0) {
+		ret = EPOLLERR | EPOLLHUP;
+	} else if (kfifo_len(&device->ring) >= ring_threshold(device, file)) {
+		ret = EPOLLIN | EPOLLRDNORM;
+	} else if (!device->sampling) {
+		ret = EPOLLERR;
+	}
+
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static const struct file_operations dev_file_ops = {
+	.owner = THIS_MODULE,
+	.open = &dev_file_open,
+	.read = &dev_file_read,
+	.poll = &dev_file_poll,
+	.release = &dev_file_release,
+	.llseek = &no_llseek
+};
+
+/***************************** Public Functions *******************************/
+
+ssize_t bme280_create_dev_mapp(void)
+{
+	ssize_t ret;
+
+	ret = alloc_chrdev_region(&bme280_devt, 0, BME280_DEV_MINORS,
+				  THIS_MODULE_NAME);
+	if (ret) {
+		pr_err(THIS_MODULE_NAME
+		       ": failed to allocate character device numbers\n");
+	}
+
+	return ret;
+}
+
+void bme280_remove_dev_mapp(void)
+{
+	unregister_chrdev_region(bme280_devt, BME280_DEV_MINORS);
+	ida_destroy(&bme280_minors);
+}
+
+ssize_t bme280_attach_dev_mapp(struct bme280 *device)
+{
+	ssize_t ret;
+	size_t i;
+
+	struct i2c_client *client = device->client;
+	struct kernfs_node *dirents[BME280_NOTIFY_ATTRS];
+
+	ret = ida_simple_get(&bme280_minors, 0, BME280_DEV_MINORS, GFP_KERNEL);
+	if (ret < 0) {
+		goto err;
+	}
+
+	device->devt = MKDEV(MAJOR(bme280_devt), ret);
+
+	/** Allocated cdev outlives the device while its files are open */
+	device->cdev = cdev_alloc();
+	if (device->cdev == NULL) {
+		ret = -ENOMEM;
+		goto remove_minor;
+	}
+
+	device->cdev->owner = THIS_MODULE;
+	device->cdev->ops = &dev_file_ops;
+
+	ret = cdev_add(device->cdev, device->devt, 1);
+	if (ret) {
+		kobject_put(&device->cdev->kobj);
+		goto remove_minor;
+	}
+
+	device->chardev = device_create_with_groups(
+		class_bme280, &client->dev, device->devt, device,
+		dev_attr_groups, THIS_MODULE_NAME "-%d-%x", client->adapter->nr,
+		client->addr);
+	if (IS_ERR(device->chardev)) {
+		ret = PTR_ERR(device->chardev);
+		device->chardev = NULL;
+		goto delete_cdev;
+	}
+
+	/** Looked up once, sampler notifies them under lock of the device */
+	for (i = 0; i < BME280_NOTIFY_ATTRS; i++) {
+		dirents[i] = sysfs_get_dirent(device->chardev->kobj.sd,
+					      notify_attrs[i]);
+		if (dirents[i] == NULL) {
+			ret = -ENOENT;
+			goto put_dirents;
+		}
+	}
+
+	bme280_lock_device(device, BME280_ENTRY_probe);
+	memcpy(device->notify_kn, dirents, sizeof(dirents));
+	bme280_unlock_device(device);
+
+	return 0;
+
+put_dirents:
+	while (i--) {
+		sysfs_put(dirents[i]);
+	}
+
+	device_destroy(class_bme280, device->devt);
+	device->chardev = NULL;
+delete_cdev:
+	cdev_del(device->cdev);
+remove_minor:
+	device->cdev = NULL;
+	ida_simple_remove(&bme280_minors, MINOR(device->devt));
+	device->devt = 0;
+err:
+	pr_err(THIS_MODULE_NAME ": failed to create character device for"
+				" device at %s-%d 0x%x\n",
+	       client->adapter->dev.of_node->name, client->adapter->nr,
+	       client->addr);
+
+	return ret;
+}
+
+void bme280_detach_dev_mapp(struct bme280 *device)
+{
+	dev_t devt;
+	size_t i;
+
+	struct kernfs_node *dirents[BME280_NOTIFY_ATTRS];
+
+	if (device == NULL || device->cdev == NULL) {
+		return;
+	}
+
+	/** Open files of the device fail and sampler stops notifying */
+	bme280_lock_device(device, BME280_ENTRY_remove);
+	devt = device->devt;
+	device->devt = 0;
+	device->chardev = NULL;
+	memcpy(dirents, device->notify_kn, sizeof(dirents));
+	memset(device->notify_kn, 0, sizeof(device->notify_kn));
+	bme280_unlock_device(device);
+
+	atomic_inc(&device->samples_generation);
+	wake_up_interruptible_poll(&device->samples_wait, EPOLLHUP);
+
+	for (i = 0; i < BME280_NOTIFY_ATTRS; i++) {
+		sysfs_put(dirents[i]);
+	}
+
+	device_destroy(class_bme280, devt);
+	cdev_del(device->cdev);
+	device->cdev = NULL;
+
+	ida_simple_remove(&bme280_minors, MINOR(devt));
+}
+
+void bme280_notify_dev_mapp(struct bme280 *device)
+{
+	size_t i;
+
+	for (i = 0; i < BME280_NOTIFY_ATTRS; i++) {
+		if (device->notify_kn[i] != NULL) {
+			sysfs_notify_dirent(device->notify_kn[i]);
+		}
+	}
+}
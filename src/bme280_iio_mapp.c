@@ -0,0 +1,407 @@
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include <linux/math64.h>
+#include <linux/log2.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+
+#include <module.h>
+#include <bme280.h>
+#include <bme280_sampler.h>
+#include <bme280_iio_mapp.h>
+
+/** Sampling frequency is in µHz and normal mode period is in µs */
+#define IIO_MICRO 1000000
+
+/******************************* IIO Channels *********************************/
+
+enum { BME280_IIO_TEMP, BME280_IIO_PRESS, BME280_IIO_HUM, BME280_IIO_TS };
+
+#define BME280_IIO_CHANNEL(_type, _index, _sign)                               \
+	{                                                                      \
+		.type = _type, .address = _index, .scan_index = _index,        \
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW) |                 \
+				      BIT(IIO_CHAN_INFO_SCALE) |               \
+				      BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO),   \
+		.info_mask_separate_available =                                \
+			BIT(IIO_CHAN_INFO_OVERSAMPLING_RATIO),                 \
+		.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMPLING_FREQ),   \
+		.scan_type = {                                                 \
+			.sign = _sign,                                         \
+			.realbits = 32,                                        \
+			.storagebits = 32,                                     \
+			.endianness = IIO_CPU,                                 \
+		},                                                             \
+	}
+
+static const struct iio_chan_spec iio_channels[] = {
+	BME280_IIO_CHANNEL(IIO_TEMP, BME280_IIO_TEMP, 's'),
+	BME280_IIO_CHANNEL(IIO_PRESSURE, BME280_IIO_PRESS, 'u'),
+	BME280_IIO_CHANNEL(IIO_HUMIDITYRELATIVE, BME280_IIO_HUM, 'u'),
+	IIO_CHAN_SOFT_TIMESTAMP(BME280_IIO_TS),
+};
+
+/** Oversampling ratios of BME280_OVERSAMPLING_1X..BME280_OVERSAMPLING_16X */
+static const int iio_oversampling_ratios[] = { 1, 2, 4, 8, 16 };
+
+/***************************** Common Functions *******************************/
+
+static inline struct bme280 *iio_to_device(struct iio_dev *indio_dev)
+{
+	return *(struct bme280 **)iio_priv(indio_dev);
+}
+
+static u32 sample_value(const struct bme280_sample *sample, unsigned long index)
+{
+	switch (index) {
+	case BME280_IIO_TEMP:
+		return (u32)sample->comp_data.temperature;
+	case BME280_IIO_PRESS:
+		return sample->comp_data.pressure;
+	default:
+		return sample->comp_data.humidity;
+	}
+}
+
+static u8 sample_comp(unsigned long index)
+{
+	switch (index) {
+	case BME280_IIO_TEMP:
+		return BME280_TEMP;
+	case BME280_IIO_PRESS:
+		return BME280_PRESS;
+	default:
+		return BME280_HUM;
+	}
+}
+
+static u8 *channel_osrs(struct bme280_settings *settings, unsigned long index,
+			u8 *desired_settings)
+{
+	switch (index) {
+	case BME280_IIO_TEMP:
+		*desired_settings = BME280_OSRS_TEMP_SEL;
+		return &settings->osrs_t;
+	case BME280_IIO_PRESS:
+		*desired_settings = BME280_OSRS_PRESS_SEL;
+		return &settings->osrs_p;
+	default:
+		*desired_settings = BME280_OSRS_HUM_SEL;
+		return &settings->osrs_h;
+	}
+}
+
+/** Standby time which makes normal mode period closest to the given one */
+static u8 closest_standby_time(const struct bme280_settings *settings,
+			       u64 period)
+{
+	struct bme280_settings candidate = *settings;
+	u64 best_diff = U64_MAX;
+	u64 diff;
+	u64 candidate_period;
+	u8 best = settings->standby_time;
+	u8 standby_time;
+
+	for (standby_time = BME280_STANDBY_TIME_0_5_MS;
+	     standby_time <= BME280_STANDBY_TIME_20_MS; standby_time++) {
+		candidate.standby_time = standby_time;
+		candidate_period = bme280_calc_standby_time(&candidate) +
+				   bme280_calc_meas_time(&candidate);
+		diff = candidate_period > period ? candidate_period - period :
+						   period - candidate_period;
+		if (diff < best_diff) {
+			best_diff = diff;
+			best = standby_time;
+		}
+	}
+
+	return best;
+}
+
+/***************************** IIO Operations *********************************/
+
+/** Compensation of the channel doesn't hold lock of the device */
+static int iio_read_channel(struct bme280 *device, unsigned long index,
+			    int *val)
+{
+	ssize_t ret;
+
+	struct bme280_calib_data calib_data;
+	struct bme280_sample sample;
+	u64 arrival = ktime_get_ns();
+
+	bme280_lock_device(device, BME280_ENTRY_iio_read);
+	ret = bme280_get_raw_sample(device, arrival, &sample, &calib_data);
+	bme280_unlock_device(device);
+
+	if (ret != BME280_OK) {
+		return -EIO;
+	}
+
+	bme280_compensate_data(sample_comp(index), &sample.uncomp_data,
+			       &sample.comp_data, &calib_data);
+	*val = (int)sample_value(&sample, index);
+
+	return IIO_VAL_INT;
+}
+
+static int iio_info_read_raw(struct iio_dev *indio_dev,
+			struct iio_chan_spec const *chan, int *val, int *val2,
+			long mask)
+{
+	int ret;
+
+	struct bme280 *device = iio_to_device(indio_dev);
+	u8 desired_settings;
+	u8 osrs;
+
+	/** Triggered buffer owns conversions while it is enabled */
+	if (mask == IIO_CHAN_INFO_RAW) {
+		ret = iio_device_claim_direct_mode(indio_dev);
+		if (ret) {
+			return ret;
+		}
+
+		ret = iio_read_channel(device, chan->address, val);
+		iio_device_release_direct_mode(indio_dev);
+
+		return ret;
+	}
+
+	bme280_lock_device(device, BME280_ENTRY_iio_read);
+
+	switch (mask) {
+	case IIO_CHAN_INFO_SCALE:
+		switch (chan->type) {
+		case IIO_TEMP: /** °C * 100 to m°C */
+			*val = 10;
+			ret = IIO_VAL_INT;
+			break;
+		case IIO_PRESSURE: /** Pa to kPa */
+			*val = 1;
+			*val2 = 1000;
+			ret = IIO_VAL_FRACTIONAL;
+			break;
+		default: /** % * 1024 to m% */
+			*val = 1000;
+			*val2 = 1024;
+			ret = IIO_VAL_FRACTIONAL;
+			break;
+		}
+		break;
+	case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+		osrs = *channel_osrs(&device->settings, chan->address,
+				     &desired_settings);
+		*val = osrs ? 1 << (osrs - 1) : 0;
+		ret = IIO_VAL_INT;
+		break;
+	case IIO_CHAN_INFO_SAMPLING_FREQ:
+		*val = IIO_MICRO;
+		*val2 = bme280_calc_standby_time(&device->settings) +
+			bme280_calc_meas_time(&device->settings);
+		ret = IIO_VAL_FRACTIONAL;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static int iio_info_write_raw(struct iio_dev *indio_dev,
+			 struct iio_chan_spec const *chan, int val, int val2,
+			 long mask)
+{
+	int ret;
+
+	struct bme280 *device = iio_to_device(indio_dev);
+	u8 desired_settings;
+	u8 *osrs;
+	u64 freq;
+	size_t i;
+
+	bme280_lock_device(device, BME280_ENTRY_iio_write);
+
+	switch (mask) {
+	case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+		ret = -EINVAL;
+		for (i = 0; i < ARRAY_SIZE(iio_oversampling_ratios); i++) {
+			if (iio_oversampling_ratios[i] == val) {
+				ret = 0;
+				break;
+			}
+		}
+
+		if (ret) {
+			break;
+		}
+
+		osrs = channel_osrs(&device->settings, chan->address,
+				    &desired_settings);
+		*osrs = ilog2(val) + 1;
+
+		ret = bme280_set_sensor_settings(device, desired_settings);
+		if (ret != BME280_OK) {
+			ret = -EIO;
+		}
+		break;
+	case IIO_CHAN_INFO_SAMPLING_FREQ:
+		freq = (u64)val * IIO_MICRO + val2;
+		if ((val < 0) || (val2 < 0) || (freq == 0)) {
+			ret = -EINVAL;
+			break;
+		}
+
+		device->settings.standby_time = closest_standby_time(
+			&device->settings,
+			div64_u64((u64)IIO_MICRO * IIO_MICRO, freq));
+
+		ret = bme280_set_sensor_settings(device,
+						 BME280_STANDBY_TIME_SEL);
+		if (ret != BME280_OK) {
+			ret = -EIO;
+		}
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	bme280_unlock_device(device);
+
+	return ret;
+}
+
+static int iio_info_read_avail(struct iio_dev *indio_dev,
+			  struct iio_chan_spec const *chan, const int **vals,
+			  int *type, int *length, long mask)
+{
+	switch (mask) {
+	case IIO_CHAN_INFO_OVERSAMPLING_RATIO:
+		*vals = iio_oversampling_ratios;
+		*type = IIO_VAL_INT;
+		*length = ARRAY_SIZE(iio_oversampling_ratios);
+		return IIO_AVAIL_LIST;
+	default:
+		return -EINVAL;
+	}
+}
+
+static const struct iio_info iio_info_ops = {
+	.read_raw = &iio_info_read_raw,
+	.write_raw = &iio_info_write_raw,
+	.read_avail = &iio_info_read_avail,
+};
+
+/**************************** Triggered Buffer ********************************/
+
+static irqreturn_t iio_buffer_trigger_handler(int irq, void *p)
+{
+	ssize_t ret;
+
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct bme280 *device = iio_to_device(indio_dev);
+	struct bme280_calib_data calib_data;
+	struct bme280_sample sample;
+	struct {
+		u32 channels[3];
+		s64 timestamp __aligned(8);
+	} scan;
+	unsigned int bit;
+	unsigned int i = 0;
+
+	bme280_lock_device(device, BME280_ENTRY_iio_trigger);
+	ret = bme280_get_raw_sample(device, ktime_get_ns(), &sample,
+				    &calib_data);
+	bme280_unlock_device(device);
+
+	if (ret != BME280_OK) {
+		goto done;
+	}
+
+	bme280_compensate_data(BME280_ALL, &sample.uncomp_data,
+			       &sample.comp_data, &calib_data);
+
+	memset(&scan, 0, sizeof(scan));
+
+	/** Enabled channels are packed in scan index order */
+	for_each_set_bit (bit, indio_dev->active_scan_mask, BME280_IIO_TS) {
+		scan.channels[i++] = sample_value(&sample, bit);
+	}
+
+	iio_push_to_buffers_with_timestamp(indio_dev, &scan, pf->timestamp);
+
+done:
+	iio_trigger_notify_done(indio_dev->trig);
+
+	return IRQ_HANDLED;
+}
+
+/***************************** Public Functions *******************************/
+
+ssize_t bme280_attach_iio_mapp(struct bme280 *device)
+{
+	ssize_t ret;
+
+	struct iio_dev *indio_dev;
+
+	indio_dev = iio_device_alloc(sizeof(device));
+	if (indio_dev == NULL) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	*(struct bme280 **)iio_priv(indio_dev) = device;
+
+	indio_dev->dev.parent = &device->client->dev;
+	indio_dev->name = THIS_MODULE_NAME;
+	indio_dev->info = &iio_info_ops;
+	indio_dev->channels = iio_channels;
+	indio_dev->num_channels = ARRAY_SIZE(iio_channels);
+	indio_dev->modes = INDIO_DIRECT_MODE;
+
+	ret = iio_triggered_buffer_setup(indio_dev, &iio_pollfunc_store_time,
+					 &iio_buffer_trigger_handler, NULL);
+	if (ret) {
+		goto free_iio_device;
+	}
+
+	ret = iio_device_register(indio_dev);
+	if (ret) {
+		goto cleanup_buffer;
+	}
+
+	device->iio = indio_dev;
+
+	return 0;
+
+cleanup_buffer:
+	iio_triggered_buffer_cleanup(indio_dev);
+free_iio_device:
+	iio_device_free(indio_dev);
+err:
+	pr_err(THIS_MODULE_NAME ": failed to register device at %s-%d 0x%x"
+				" in IIO\n",
+	       device->client->adapter->dev.of_node->name,
+	       device->client->adapter->nr, device->client->addr);
+
+	return ret;
+}
+
+void bme280_detach_iio_mapp(struct bme280 *device)
+{
+	if (device == NULL || device->iio == NULL) {
+		return;
+	}
+
+	iio_device_unregister(device->iio);
+	iio_triggered_buffer_cleanup(device->iio);
+	iio_device_free(device->iio);
+	device->iio = NULL;
+}
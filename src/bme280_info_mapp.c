@@ -1,12 +1,15 @@
 #include <linux/proc_fs.h>
-#include <linux/uaccess.h>
+#include <linux/seq_file.h>
 #include <linux/stat.h>
-#include <linux/slab.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/rcupdate.h>
+#include <linux/timekeeping.h>
 
 #include <module.h>
 #include <bme280.h>
 #include <bme280_info_mapp.h>
+#include <bme280_sampler.h>
 
 #ifdef DEBUG
 #define ENABLE_CALIB_DATA_INFO_MAPP
@@ -14,44 +17,32 @@
 
 /***************************** Extern Variables *******************************/
 
-extern struct bme280 *bme280_device;
-
 extern struct list_head bme280_devices;
-extern struct mutex bme280_devices_lock;
 
 /***************************** Common Functions *******************************/
 
-static inline ssize_t bme280_device_null_ptr_check(void)
+/**
+ * Looks up the device at the position of the registry and takes a reference,
+ * so it outlives removal while it is shown
+ */
+static struct bme280 *get_device_at(loff_t pos)
 {
-	if (bme280_device == NULL) {
-		pr_warn(THIS_MODULE_NAME
-			": current device not specified, use /sys/bme280/i2c"
-			" to specify\n");
-
-		return -ENODEV;
-	} else {
-		return BME280_OK;
-	}
-}
+	struct bme280 *device;
 
-static inline size_t proc_read(char **buf, size_t *buf_len, char __user *ubuf,
-			       size_t count, loff_t *off)
-{
-	size_t left;
+	rcu_read_lock();
 
-	if (*off >= *buf_len) {
-		*off = 0;
-		return 0;
-	}
+	list_for_each_entry_rcu (device, &bme280_devices, registered) {
+		if (pos-- == 0) {
+			bme280_get_device(device);
+			rcu_read_unlock();
 
-	if (count > *buf_len - *off) {
-		count = *buf_len - *off;
+			return device;
+		}
 	}
 
-	left = copy_to_user(ubuf, (*buf) + *off, count);
-	*off += count;
+	rcu_read_unlock();
 
-	return count;
+	return NULL;
 }
 
 /****************************** Procfs Utils **********************************/
@@ -59,211 +50,296 @@ static inline size_t proc_read(char **buf, size_t *buf_len, char __user *ubuf,
 #define PROC_DIR(name) struct proc_dir_entry *proc_dir_##name = NULL
 #define PROC_FILE(name) struct proc_dir_entry *proc_file_##name = NULL
 
-/*************** Info about current selected device (Procfs) ******************/
-
-#define BME280INFO_BUF_MAX_LEN 512
-#define PROC_FILE_BME280INFO "bme280info"
-
-static char *bme280info_buf = NULL;
-static size_t bme280info_buf_len = 0;
-static u8 bme280info_reading = 0;
+/**
+ * Records of every registered device, each reader iterates with its own
+ * buffer and locks one device at a time
+ */
+static void *proc_devices_start(struct seq_file *s, loff_t *pos)
+{
+	return get_device_at(*pos);
+}
 
-static ssize_t prepare_bme280info(void)
+static void *proc_devices_next(struct seq_file *s, void *v, loff_t *pos)
 {
-	ssize_t ret;
+	bme280_put_device(v);
+	(*pos)++;
 
-	u8 sensor_mode;
-	struct bme280_data comp_data;
+	return get_device_at(*pos);
+}
 
-	mutex_lock(&bme280_devices_lock);
+static void proc_devices_stop(struct seq_file *s, void *v)
+{
+	if (v != NULL) {
+		bme280_put_device(v);
+	}
+}
 
-	memset(bme280info_buf, '\0', BME280INFO_BUF_MAX_LEN);
+static void proc_devices_show_i2c(struct seq_file *s, struct bme280 *device)
+{
+	seq_printf(s,
+		   "I2C Adapter              : %s-%d\n"
+		   "I2C Address              : 0x%x\n"
+		   "\n",
+		   device->client->adapter->dev.of_node->name,
+		   device->client->adapter->nr, device->client->addr);
+}
 
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
+/****************** Info about registered devices (Procfs) ********************/
 
-	ret = bme280_get_sensor_settings(bme280_device);
-	if (ret != BME280_OK) {
-		goto err;
-	}
+#define PROC_FILE_BME280INFO "bme280info"
 
-	ret = bme280_get_sensor_mode(bme280_device, &sensor_mode);
-	if (ret != BME280_OK) {
-		goto err;
-	}
+static int proc_file_bme280info_show(struct seq_file *s, void *v)
+{
+	ssize_t ret;
 
-	ret = bme280_get_sensor_data_forced(bme280_device, BME280_ALL,
-					    &comp_data);
-	if (ret != BME280_OK) {
-		goto err;
-	}
+	struct bme280 *device = v;
+	u8 sensor_mode = BME280_NORMAL_MODE;
+	struct bme280_snapshot snapshot;
+	struct bme280_settings settings;
+	struct bme280_calib_data calib_data;
+	struct bme280_sample sample;
+	u32 soft_resets;
+	u32 conversions;
+	u32 coalesced;
+	u64 arrival = ktime_get_ns();
 
-	bme280info_buf_len = sprintf(
-		bme280info_buf,
-		"I2C Adapter              : %s-%d\n"
-		"I2C Address              : 0x%x\n"
-		"\n"
-		"Chip Id                  : 0x%x\n"
-		"Power Mode               : 0x%x\n"
-		"Pressure Oversampling    : 0x%x\n"
-		"Temperature Oversampling : 0x%x\n"
-		"Humidity Oversampling    : 0x%x\n"
-		"Filter Coefficient       : 0x%x\n"
-		"Standby Time             : 0x%x\n"
-		"\n"
-		"Pressure                 : %d\n"
-		"Temperature              : %d\n"
-		"Humidity                 : %d\n",
-		bme280_device->client->adapter->dev.of_node->name,
-		bme280_device->client->adapter->nr, bme280_device->client->addr,
-		bme280_device->chip_id, sensor_mode,
-		bme280_device->settings.osrs_p, bme280_device->settings.osrs_t,
-		bme280_device->settings.osrs_h, bme280_device->settings.filter,
-		bme280_device->settings.standby_time, comp_data.pressure,
-		comp_data.temperature, comp_data.humidity);
+	bme280_lock_device(device, BME280_ENTRY_proc_info);
 
-err:
-	mutex_unlock(&bme280_devices_lock);
+	/** Device was removed after it had been looked up */
+	if (device->removed) {
+		bme280_unlock_device(device);
 
-	return ret;
-}
+		return SEQ_SKIP;
+	}
 
-static ssize_t proc_file_bme280info_read(struct file *file, char __user *ubuf,
-					 size_t count, loff_t *off)
-{
-	ssize_t ret;
+	proc_devices_show_i2c(s, device);
 
-	if (!bme280info_reading) {
-		ret = prepare_bme280info();
+	/**
+	 * Sampler keeps the device in normal mode with cached settings,
+	 * otherwise both come from a single burst
+	 */
+	if (!device->sampling) {
+		ret = bme280_get_snapshot(device, &snapshot);
 		if (ret != BME280_OK) {
 			goto err;
 		}
 
-		bme280info_reading = 1;
+		device->settings = snapshot.settings;
+		sensor_mode = snapshot.mode;
 	}
 
-	count = proc_read(&bme280info_buf, &bme280info_buf_len, ubuf, count,
-			  off);
-	if (count == 0) {
-		bme280info_reading = 0;
+	/** Latest sample is shown as is, /proc/bme280data takes a new one */
+	sample = device->sample;
+	calib_data = device->calib_data;
+	settings = device->settings;
+	soft_resets = device->soft_resets;
+	conversions = device->conversions;
+	coalesced = device->coalesced;
+
+	bme280_stats_entry(device->stats, BME280_ENTRY_proc_info, arrival);
+	bme280_unlock_device(device);
+
+	/** Compensation and formatting don't hold lock of the device */
+	if (sample.timestamp != 0) {
+		bme280_compensate_data(BME280_ALL, &sample.uncomp_data,
+				       &sample.comp_data, &calib_data);
 	}
 
-	return count;
+	seq_printf(s,
+		   "Chip Id                  : 0x%x\n"
+		   "Power Mode               : 0x%x\n"
+		   "Pressure Oversampling    : 0x%x\n"
+		   "Temperature Oversampling : 0x%x\n"
+		   "Humidity Oversampling    : 0x%x\n"
+		   "Filter Coefficient       : 0x%x\n"
+		   "Standby Time             : 0x%x\n"
+		   "\n"
+		   "Pressure                 : %d\n"
+		   "Temperature              : %d\n"
+		   "Humidity                 : %d\n"
+		   "Timestamp                : %llu\n"
+		   "\n"
+		   "Soft Resets              : %u\n"
+		   "Forced Conversions       : %u\n"
+		   "Coalesced Requests       : %u\n"
+		   "\n",
+		   device->chip_id, sensor_mode, settings.osrs_p,
+		   settings.osrs_t, settings.osrs_h, settings.filter,
+		   settings.standby_time, sample.comp_data.pressure,
+		   sample.comp_data.temperature, sample.comp_data.humidity,
+		   sample.timestamp, soft_resets, conversions, coalesced);
+
+	return 0;
 
 err:
-	return ret;
+	bme280_stats_entry(device->stats, BME280_ENTRY_proc_info, arrival);
+	bme280_unlock_device(device);
+
+	/** Failure of one device does not hide the others */
+	seq_printf(s,
+		   "Error                    : %zd\n"
+		   "\n",
+		   ret);
+
+	return 0;
 }
 
-static PROC_FILE(bme280info);
-static struct file_operations proc_file_bme280info_ops = {
-	.owner = THIS_MODULE,
-	.read = &proc_file_bme280info_read,
-	.write = NULL
+static const struct seq_operations proc_file_bme280info_seq_ops = {
+	.start = &proc_devices_start,
+	.next = &proc_devices_next,
+	.stop = &proc_devices_stop,
+	.show = &proc_file_bme280info_show
 };
 
-/******************** Device calibration data (Procfs) ************************/
+static int proc_file_bme280info_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &proc_file_bme280info_seq_ops);
+}
 
-#ifdef ENABLE_CALIB_DATA_INFO_MAPP
+static PROC_FILE(bme280info);
+static const struct file_operations proc_file_bme280info_ops = {
+	.owner = THIS_MODULE,
+	.open = &proc_file_bme280info_open,
+	.read = &seq_read,
+	.llseek = &seq_lseek,
+	.release = &seq_release
+};
 
-#define BME280CALIB_BUF_MAX_LEN 712
-#define PROC_FILE_BME280CALIB "bme280calib"
+/************** Measurements of current selected device (Procfs) **************/
 
-static char *bme280calib_buf = NULL;
-static size_t bme280calib_buf_len = 0;
-static u8 bme280calib_reading = 0;
+#define PROC_FILE_BME280DATA "bme280data"
 
-static ssize_t prepare_bme280calib(void)
+static int proc_file_bme280data_show(struct seq_file *s, void *data)
 {
-	ssize_t ret;
+	int ret;
 
-	mutex_lock(&bme280_devices_lock);
+	struct bme280 *device = NULL;
+	struct bme280_calib_data calib_data;
+	struct bme280_sample sample;
+	u64 arrival = ktime_get_ns();
 
-	memset(bme280calib_buf, '\0', BME280CALIB_BUF_MAX_LEN);
+	ret = bme280_lock_selected_device(&device, BME280_ENTRY_proc_data);
+	if (ret != BME280_OK) {
+		goto unlock_device;
+	}
 
-	ret = bme280_device_null_ptr_check();
+	/** All channels come from a single conversion and data burst */
+	ret = bme280_get_raw_sample(device, arrival, &sample, &calib_data);
+	bme280_stats_entry(device->stats, BME280_ENTRY_proc_data, arrival);
 	if (ret != BME280_OK) {
-		goto err;
+		ret = -EAGAIN;
+		goto unlock_device;
 	}
 
-	bme280calib_buf_len = sprintf(bme280calib_buf,
-				      "Temperature compensation 1 : %d\n"
-				      "Temperature compensation 2 : %d\n"
-				      "Temperature compensation 3 : %d\n"
-				      "\n"
-				      "Pressure compensation 1    : %d\n"
-				      "Pressure compensation 2    : %d\n"
-				      "Pressure compensation 3    : %d\n"
-				      "Pressure compensation 4    : %d\n"
-				      "Pressure compensation 5    : %d\n"
-				      "Pressure compensation 6    : %d\n"
-				      "Pressure compensation 7    : %d\n"
-				      "Pressure compensation 8    : %d\n"
-				      "Pressure compensation 9    : %d\n"
-				      "\n"
-				      "Humidity compensation 1    : %d\n"
-				      "Humidity compensation 2    : %d\n"
-				      "Humidity compensation 3    : %d\n"
-				      "Humidity compensation 4    : %d\n"
-				      "Humidity compensation 5    : %d\n"
-				      "Humidity compensation 6    : %d\n",
-				      bme280_device->calib_data.dig_T1,
-				      bme280_device->calib_data.dig_T1,
-				      bme280_device->calib_data.dig_T3,
-				      bme280_device->calib_data.dig_P1,
-				      bme280_device->calib_data.dig_P2,
-				      bme280_device->calib_data.dig_P3,
-				      bme280_device->calib_data.dig_P4,
-				      bme280_device->calib_data.dig_P5,
-				      bme280_device->calib_data.dig_P6,
-				      bme280_device->calib_data.dig_P7,
-				      bme280_device->calib_data.dig_P8,
-				      bme280_device->calib_data.dig_P9,
-				      bme280_device->calib_data.dig_H1,
-				      bme280_device->calib_data.dig_H2,
-				      bme280_device->calib_data.dig_H3,
-				      bme280_device->calib_data.dig_H4,
-				      bme280_device->calib_data.dig_H5,
-				      bme280_device->calib_data.dig_H6);
+	bme280_unlock_selected_device(device);
 
-err:
-	mutex_unlock(&bme280_devices_lock);
+	/** Compensation and formatting don't hold lock of the device */
+	bme280_compensate_data(BME280_ALL, &sample.uncomp_data,
+			       &sample.comp_data, &calib_data);
+	seq_printf(s, "%u %d %u %llu\n", sample.comp_data.pressure,
+		   sample.comp_data.temperature, sample.comp_data.humidity,
+		   sample.timestamp);
+
+	return 0;
+
+unlock_device:
+	bme280_unlock_selected_device(device);
 
 	return ret;
 }
 
-static ssize_t proc_file_bme280calib_read(struct file *file, char __user *ubuf,
-					  size_t count, loff_t *off)
+static int proc_file_bme280data_open(struct inode *inode, struct file *file)
 {
-	ssize_t ret;
+	return single_open(file, &proc_file_bme280data_show, NULL);
+}
 
-	if (!bme280calib_reading) {
-		ret = prepare_bme280calib();
-		if (ret != BME280_OK) {
-			goto err;
-		}
+static PROC_FILE(bme280data);
+static const struct file_operations proc_file_bme280data_ops = {
+	.owner = THIS_MODULE,
+	.open = &proc_file_bme280data_open,
+	.read = &seq_read,
+	.llseek = &seq_lseek,
+	.release = &single_release
+};
 
-		bme280calib_reading = 1;
-	}
+/******************** Device calibration data (Procfs) ************************/
 
-	count = proc_read(&bme280calib_buf, &bme280calib_buf_len, ubuf, count,
-			  off);
-	if (count == 0) {
-		bme280calib_reading = 0;
+#ifdef ENABLE_CALIB_DATA_INFO_MAPP
+
+#define PROC_FILE_BME280CALIB "bme280calib"
+
+static int proc_file_bme280calib_show(struct seq_file *s, void *v)
+{
+	struct bme280 *device = v;
+	u64 arrival = ktime_get_ns();
+
+	bme280_lock_device(device, BME280_ENTRY_proc_calib);
+
+	if (device->removed) {
+		bme280_unlock_device(device);
+
+		return SEQ_SKIP;
 	}
 
-	return count;
+	proc_devices_show_i2c(s, device);
+
+	seq_printf(s,
+		   "Temperature compensation 1 : %d\n"
+		   "Temperature compensation 2 : %d\n"
+		   "Temperature compensation 3 : %d\n"
+		   "\n"
+		   "Pressure compensation 1    : %d\n"
+		   "Pressure compensation 2    : %d\n"
+		   "Pressure compensation 3    : %d\n"
+		   "Pressure compensation 4    : %d\n"
+		   "Pressure compensation 5    : %d\n"
+		   "Pressure compensation 6    : %d\n"
+		   "Pressure compensation 7    : %d\n"
+		   "Pressure compensation 8    : %d\n"
+		   "Pressure compensation 9    : %d\n"
+		   "\n"
+		   "Humidity compensation 1    : %d\n"
+		   "Humidity compensation 2    : %d\n"
+		   "Humidity compensation 3    : %d\n"
+		   "Humidity compensation 4    : %d\n"
+		   "Humidity compensation 5    : %d\n"
+		   "Humidity compensation 6    : %d\n"
+		   "\n",
+		   device->calib_data.dig_T1, device->calib_data.dig_T2,
+		   device->calib_data.dig_T3, device->calib_data.dig_P1,
+		   device->calib_data.dig_P2, device->calib_data.dig_P3,
+		   device->calib_data.dig_P4, device->calib_data.dig_P5,
+		   device->calib_data.dig_P6, device->calib_data.dig_P7,
+		   device->calib_data.dig_P8, device->calib_data.dig_P9,
+		   device->calib_data.dig_H1, device->calib_data.dig_H2,
+		   device->calib_data.dig_H3, device->calib_data.dig_H4,
+		   device->calib_data.dig_H5, device->calib_data.dig_H6);
+
+	bme280_stats_entry(device->stats, BME280_ENTRY_proc_calib, arrival);
+	bme280_unlock_device(device);
 
-err:
-	return ret;
+	return 0;
+}
+
+static const struct seq_operations proc_file_bme280calib_seq_ops = {
+	.start = &proc_devices_start,
+	.next = &proc_devices_next,
+	.stop = &proc_devices_stop,
+	.show = &proc_file_bme280calib_show
+};
+
+static int proc_file_bme280calib_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &proc_file_bme280calib_seq_ops);
 }
 
 static PROC_FILE(bme280calib);
-static struct file_operations proc_file_bme280calib_ops = {
+static const struct file_operations proc_file_bme280calib_ops = {
 	.owner = THIS_MODULE,
-	.read = &proc_file_bme280calib_read,
-	.write = NULL
+	.open = &proc_file_bme280calib_open,
+	.read = &seq_read,
+	.llseek = &seq_lseek,
+	.release = &seq_release
 };
 
 #endif /* ENABLE_CALIB_DATA_INFO_MAPP */
@@ -286,14 +362,15 @@ ssize_t bme280_create_info_mapp(void)
 		goto err;
 	}
 
-	bme280info_buf = kmalloc_array(BME280INFO_BUF_MAX_LEN,
-				       sizeof(*bme280info_buf), GFP_KERNEL);
-	if (bme280info_buf == NULL) {
-		pr_err(THIS_MODULE_NAME ": failed to allocate %u bytes for"
-					" file '%s' in /proc\n",
-		       BME280INFO_BUF_MAX_LEN, PROC_FILE_BME280INFO);
+	proc_file_bme280data = proc_create(PROC_FILE_BME280DATA,
+					   S_IFREG | S_IRUGO, NULL,
+					   &proc_file_bme280data_ops);
+	if (proc_file_bme280data == NULL) {
+		pr_err(THIS_MODULE_NAME ": failed to create file"
+					" '%s' in /proc\n",
+		       PROC_FILE_BME280DATA);
 
-		ret = -ENOMEM;
+		ret = -ENOENT;
 		goto remove_proc_file_bme280info;
 	}
 
@@ -308,18 +385,7 @@ ssize_t bme280_create_info_mapp(void)
 		       PROC_FILE_BME280CALIB);
 
 		ret = -ENOENT;
-		goto cleanup_bme280info_buf;
-	}
-
-	bme280calib_buf = kmalloc_array(BME280CALIB_BUF_MAX_LEN,
-					sizeof(*bme280calib_buf), GFP_KERNEL);
-	if (bme280calib_buf == NULL) {
-		pr_err(THIS_MODULE_NAME ": failed to allocate %u bytes for"
-					" file '%s' in /proc\n",
-		       BME280CALIB_BUF_MAX_LEN, PROC_FILE_BME280CALIB);
-
-		ret = -ENOMEM;
-		goto remove_proc_file_bme280calib;
+		goto remove_proc_file_bme280data;
 	}
 
 #endif /* ENABLE_CALIB_DATA_INFO_MAPP */
@@ -328,11 +394,8 @@ ssize_t bme280_create_info_mapp(void)
 
 #ifdef ENABLE_CALIB_DATA_INFO_MAPP
 
-remove_proc_file_bme280calib:
-	remove_proc_entry(PROC_FILE_BME280CALIB, NULL);
-cleanup_bme280info_buf:
-	kfree(bme280info_buf);
-	bme280info_buf = NULL;
+remove_proc_file_bme280data:
+	remove_proc_entry(PROC_FILE_BME280DATA, NULL);
 
 #endif /* ENABLE_CALIB_DATA_INFO_MAPP */
 
@@ -346,19 +409,11 @@ void bme280_remove_info_mapp(void)
 {
 	remove_proc_entry(PROC_FILE_BME280INFO, NULL);
 
-	kfree(bme280info_buf);
-	bme280info_buf = NULL;
-	bme280info_buf_len = 0;
-	bme280info_reading = 0;
+	remove_proc_entry(PROC_FILE_BME280DATA, NULL);
 
 #ifdef ENABLE_CALIB_DATA_INFO_MAPP
 
 	remove_proc_entry(PROC_FILE_BME280CALIB, NULL);
 
-	kfree(bme280calib_buf);
-	bme280calib_buf = NULL;
-	bme280calib_buf_len = 0;
-	bme280calib_reading = 0;
-
 #endif /* ENABLE_CALIB_DATA_INFO_MAPP */
 }
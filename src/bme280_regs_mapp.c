@@ -1,10 +1,15 @@
 #include <linux/cdev.h>
+#include <linux/device.h>
 #include <linux/stat.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/rcupdate.h>
+#include <linux/timekeeping.h>
 
 #include <module.h>
 #include <bme280.h>
 #include <bme280_regs_mapp.h>
+#include <bme280_sampler.h>
 
 #ifdef DEBUG
 #define ENABLE_CALIB_DATA_REGS_MAPP
@@ -14,16 +19,15 @@
 
 /***************************** Extern Variables *******************************/
 
-extern struct bme280 *bme280_device;
+extern struct bme280 __rcu *bme280_device;
 
 extern struct list_head bme280_devices;
-extern struct mutex bme280_devices_lock;
 
 /***************************** Common Functions *******************************/
 
-static inline ssize_t bme280_device_null_ptr_check(void)
+static inline ssize_t bme280_device_null_ptr_check(const struct bme280 *device)
 {
-	if (bme280_device == NULL) {
+	if (device == NULL) {
 		pr_warn(THIS_MODULE_NAME
 			": current device not specified, use /sys/%s/i2c"
 			" to specify\n",
@@ -51,518 +55,476 @@ static inline ssize_t bme280_device_null_ptr_check(void)
 #define CLASS_ATTR_RO(name, show) CLASS_ATTR(name, S_IRUGO, show, NULL)
 #define CLASS_ATTR_WO(name, store) CLASS_ATTR(name, S_IWUSR, NULL, store)
 
-/******************************* Sysfs Classes ********************************/
-
-static CLASS(bme280);
-
-/************** I2C info about current selected device (Sysfs) ****************/
-
-static ssize_t class_attr_i2c_show(struct class *class,
-				   struct class_attribute *attr, char *buf)
-{
-	ssize_t ret;
-
-	/**
-	 * Protects from cases when bme280_device can be removed from
-	 * list of registed devices earlier than necessary, or when
-	 * operation performed concurrently
-	 */
-	mutex_lock(&bme280_devices_lock);
+#define DEV_ATTR(name, mode, show, store)                                      \
+	struct device_attribute dev_attr_##name =                              \
+		__ATTR(name, mode, show, store)
+#define DEV_ATTR_RW(name, show, store)                                         \
+	DEV_ATTR(name, S_IRUGO | S_IWUSR, show, store)
+#define DEV_ATTR_RO(name, show) DEV_ATTR(name, S_IRUGO, show, NULL)
+#define DEV_ATTR_WO(name, store) DEV_ATTR(name, S_IWUSR, NULL, store)
+
+/**
+ * Register attributes are implemented once on top of the device and mapped
+ * both onto the current selected device in the class and onto every device
+ */
+#define REGS_ATTR_SHOW(name, entry)                                            \
+	static ssize_t class_attr_##name##_show(                               \
+		struct class *class, struct class_attribute *attr, char *buf)  \
+	{                                                                      \
+		return class_attr_regs_show(buf, entry, &regs_##name##_show);  \
+	}                                                                      \
+	static ssize_t dev_attr_##name##_show(                                 \
+		struct device *dev, struct device_attribute *attr, char *buf)  \
+	{                                                                      \
+		return dev_attr_regs_show(dev, buf, entry,                     \
+					  &regs_##name##_show);                \
+	}
+#define REGS_ATTR_STORE(name)                                                  \
+	static ssize_t class_attr_##name##_store(struct class *class,          \
+						 struct class_attribute *attr, \
+						 const char *buf,              \
+						 size_t count)                 \
+	{                                                                      \
+		return class_attr_regs_store(buf, count,                       \
+					     BME280_ENTRY_##name##_store,      \
+					     &regs_##name##_store);            \
+	}                                                                      \
+	static ssize_t dev_attr_##name##_store(struct device *dev,             \
+					       struct device_attribute *attr,  \
+					       const char *buf, size_t count)  \
+	{                                                                      \
+		return dev_attr_regs_store(dev, buf, count,                    \
+					   BME280_ENTRY_##name##_store,        \
+					   &regs_##name##_store);              \
+	}
+
+#define REGS_ATTR_RW(name)                                                     \
+	REGS_ATTR_SHOW(name, BME280_ENTRY_##name##_show)                       \
+	REGS_ATTR_STORE(name)                                                  \
+	static CLASS_ATTR_RW(name, &class_attr_##name##_show,                  \
+			     &class_attr_##name##_store);                      \
+	static DEV_ATTR_RW(name, &dev_attr_##name##_show,                      \
+			   &dev_attr_##name##_store)
+#define REGS_ATTR_RO(name)                                                     \
+	REGS_ATTR_SHOW(name, BME280_ENTRY_##name##_show)                       \
+	static CLASS_ATTR_RO(name, &class_attr_##name##_show);                 \
+	static DEV_ATTR_RO(name, &dev_attr_##name##_show)
+/** Calibration data attributes share a single entry point in statistics */
+#define CALIB_ATTR_RO(name)                                                    \
+	REGS_ATTR_SHOW(name, BME280_ENTRY_calib_show)                          \
+	static CLASS_ATTR_RO(name, &class_attr_##name##_show);                 \
+	static DEV_ATTR_RO(name, &dev_attr_##name##_show)
+#define REGS_ATTR_WO(name)                                                     \
+	REGS_ATTR_STORE(name)                                                  \
+	static CLASS_ATTR_WO(name, &class_attr_##name##_store);                \
+	static DEV_ATTR_WO(name, &dev_attr_##name##_store)
+
+/** Measurement attributes format a sample, which is compensated without lock */
+#define SAMPLE_ATTR_RO(name, sensor_comp)                                      \
+	static ssize_t class_attr_##name##_show(                               \
+		struct class *class, struct class_attribute *attr, char *buf)  \
+	{                                                                      \
+		return class_attr_sample_show(buf, sensor_comp,                \
+					      BME280_ENTRY_##name##_show,      \
+					      &regs_##name##_show);            \
+	}                                                                      \
+	static ssize_t dev_attr_##name##_show(                                 \
+		struct device *dev, struct device_attribute *attr, char *buf)  \
+	{                                                                      \
+		return dev_attr_sample_show(dev, buf, sensor_comp,             \
+					    BME280_ENTRY_##name##_show,        \
+					    &regs_##name##_show);              \
+	}                                                                      \
+	static CLASS_ATTR_RO(name, &class_attr_##name##_show);                 \
+	static DEV_ATTR_RO(name, &dev_attr_##name##_show)
 
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		ret = sprintf(buf, "none\n");
-	} else {
-		ret = sprintf(buf, "%s-%d 0x%x\n",
-			      bme280_device->client->adapter->dev.of_node->name,
-			      bme280_device->client->adapter->nr,
-			      bme280_device->client->addr);
-	}
+/******************************* Sysfs Classes ********************************/
 
-	mutex_unlock(&bme280_devices_lock);
+/** Class is shared with character devices of samples */
+CLASS(bme280);
 
-	return ret;
-}
+/************************** Register attributes *******************************/
 
-static ssize_t class_attr_i2c_store(struct class *class,
-				    struct class_attribute *attr,
-				    const char *buf, size_t count)
+static ssize_t class_attr_regs_show(char *buf, enum bme280_entry entry,
+				    ssize_t (*show)(struct bme280 *device,
+						    u64 arrival, char *buf))
 {
 	ssize_t ret;
 
-	struct list_head *iter = NULL;
 	struct bme280 *device = NULL;
+	u64 arrival = ktime_get_ns();
 
-	u8 adapter_nr;
-	u8 addr;
-	u8 contains;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = sscanf(buf, "%hhu 0x%hhx\n", &adapter_nr, &addr);
-	if (ret != 2) {
-		pr_err(THIS_MODULE_NAME
-		       ": invalid argument, try to write i2c adapter number "
-		       " in decimal and device address in hex\n");
-
-		ret = -EINVAL;
+	ret = bme280_lock_selected_device(&device, entry);
+	if (ret != BME280_OK) {
 		goto err;
 	}
 
-	list_for_each (iter, &bme280_devices) {
-		device = list_entry(iter, struct bme280, registered);
-		if (adapter_nr == device->client->adapter->nr &&
-		    addr == device->client->addr) {
-			contains = 1;
-			break;
-		}
-	}
-
-	if (contains) {
-		bme280_device = device;
-		ret = count;
-	} else {
-		pr_warn(THIS_MODULE_NAME
-			": device with specified i2c adapter number and"
-			" address not found in list of registered devices\n");
-
-		ret = -ENODEV;
-	}
+	ret = show(device, arrival, buf);
+	bme280_stats_entry(device->stats, entry, arrival);
 
 err:
-	mutex_unlock(&bme280_devices_lock);
+	bme280_unlock_selected_device(device);
 
 	return ret;
 }
 
-static CLASS_ATTR_RW(i2c, &class_attr_i2c_show, &class_attr_i2c_store);
-
-/********************* Device calibration data (Sysfs) ************************/
-
-#ifdef ENABLE_CALIB_DATA_REGS_MAPP
-
-static ssize_t class_attr_dig_T1_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t class_attr_regs_store(const char *buf, size_t count,
+				     enum bme280_entry entry,
+				     ssize_t (*store)(struct bme280 *device,
+						      const char *buf,
+						      size_t count))
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
+	struct bme280 *device = NULL;
+	u64 arrival = ktime_get_ns();
 
-	ret = bme280_device_null_ptr_check();
+	ret = bme280_lock_selected_device(&device, entry);
 	if (ret != BME280_OK) {
 		goto err;
 	}
 
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_T1);
+	ret = store(device, buf, count);
+	bme280_stats_entry(device->stats, entry, arrival);
 
 err:
-	mutex_unlock(&bme280_devices_lock);
+	bme280_unlock_selected_device(device);
 
 	return ret;
 }
 
-static ssize_t class_attr_dig_T2_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+/** Reads of different devices take only their own locks */
+static ssize_t dev_attr_regs_show(struct device *dev, char *buf,
+				  enum bme280_entry entry,
+				  ssize_t (*show)(struct bme280 *device,
+						  u64 arrival, char *buf))
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
+	struct bme280 *device = dev_get_drvdata(dev);
+	u64 arrival = ktime_get_ns();
 
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_T2);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
+	bme280_lock_device(device, entry);
+	ret = show(device, arrival, buf);
+	bme280_stats_entry(device->stats, entry, arrival);
+	bme280_unlock_device(device);
 
 	return ret;
 }
 
-static ssize_t class_attr_dig_T3_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t dev_attr_regs_store(struct device *dev, const char *buf,
+				   size_t count, enum bme280_entry entry,
+				   ssize_t (*store)(struct bme280 *device,
+						    const char *buf,
+						    size_t count))
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
+	struct bme280 *device = dev_get_drvdata(dev);
+	u64 arrival = ktime_get_ns();
 
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_T3);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
+	bme280_lock_device(device, entry);
+	ret = store(device, buf, count);
+	bme280_stats_entry(device->stats, entry, arrival);
+	bme280_unlock_device(device);
 
 	return ret;
 }
 
-static ssize_t class_attr_dig_P1_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+/************************** Measurement attributes ****************************/
+
+/**
+ * Sample is taken under lock of the device, while compensation and formatting
+ * run after it is dropped
+ */
+static ssize_t format_sample(ssize_t ret, u8 sensor_comp,
+			     struct bme280_sample *sample,
+			     const struct bme280_calib_data *calib_data,
+			     char *buf,
+			     ssize_t (*show)(const struct bme280_sample *sample,
+					     char *buf))
 {
-	ssize_t ret;
+	if (ret != BME280_OK) {
+		pr_err(THIS_MODULE_NAME ": failed to get measurements from"
+					" sesnsor, try again later\n");
 
-	mutex_lock(&bme280_devices_lock);
+		return -EAGAIN;
+	}
 
-	ret = bme280_device_null_ptr_check();
+	ret = bme280_compensate_data(sensor_comp, &sample->uncomp_data,
+				     &sample->comp_data, calib_data);
 	if (ret != BME280_OK) {
-		goto err;
+		return -EINVAL;
 	}
 
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_P1);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
-
-	return ret;
+	return show(sample, buf);
 }
 
-static ssize_t class_attr_dig_P2_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t class_attr_sample_show(
+	char *buf, u8 sensor_comp, enum bme280_entry entry,
+	ssize_t (*show)(const struct bme280_sample *sample, char *buf))
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
+	struct bme280 *device = NULL;
+	struct bme280_calib_data calib_data;
+	struct bme280_sample sample;
+	u64 arrival = ktime_get_ns();
 
-	ret = bme280_device_null_ptr_check();
+	ret = bme280_lock_selected_device(&device, entry);
 	if (ret != BME280_OK) {
-		goto err;
-	}
+		bme280_unlock_selected_device(device);
 
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_P2);
+		return ret;
+	}
 
-err:
-	mutex_unlock(&bme280_devices_lock);
+	ret = bme280_get_raw_sample(device, arrival, &sample, &calib_data);
+	bme280_stats_entry(device->stats, entry, arrival);
+	bme280_unlock_selected_device(device);
 
-	return ret;
+	return format_sample(ret, sensor_comp, &sample, &calib_data, buf,
+			     show);
 }
 
-static ssize_t class_attr_dig_P3_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t dev_attr_sample_show(
+	struct device *dev, char *buf, u8 sensor_comp, enum bme280_entry entry,
+	ssize_t (*show)(const struct bme280_sample *sample, char *buf))
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_P3);
+	struct bme280 *device = dev_get_drvdata(dev);
+	struct bme280_calib_data calib_data;
+	struct bme280_sample sample;
+	u64 arrival = ktime_get_ns();
 
-err:
-	mutex_unlock(&bme280_devices_lock);
+	bme280_lock_device(device, entry);
+	ret = bme280_get_raw_sample(device, arrival, &sample, &calib_data);
+	bme280_stats_entry(device->stats, entry, arrival);
+	bme280_unlock_device(device);
 
-	return ret;
+	return format_sample(ret, sensor_comp, &sample, &calib_data, buf,
+			     show);
 }
 
-static ssize_t class_attr_dig_P4_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+/************** I2C info about current selected device (Sysfs) ****************/
+
+static ssize_t class_attr_i2c_show(struct class *class,
+				   struct class_attribute *attr, char *buf)
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_P4);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
-
-	return ret;
-}
+	struct bme280 *device;
 
-static ssize_t class_attr_dig_P5_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
-{
-	ssize_t ret;
+	/**
+	 * Removal of a device waits for RCU readers, so its I2C client
+	 * stays valid while the device is seen here
+	 */
+	rcu_read_lock();
 
-	mutex_lock(&bme280_devices_lock);
+	device = rcu_dereference(bme280_device);
 
-	ret = bme280_device_null_ptr_check();
+	ret = bme280_device_null_ptr_check(device);
 	if (ret != BME280_OK) {
-		goto err;
+		ret = sprintf(buf, "none\n");
+	} else {
+		ret = sprintf(buf, "%s-%d 0x%x\n",
+			      device->client->adapter->dev.of_node->name,
+			      device->client->adapter->nr,
+			      device->client->addr);
 	}
 
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_P5);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
+	rcu_read_unlock();
 
 	return ret;
 }
 
-static ssize_t class_attr_dig_P6_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t class_attr_i2c_store(struct class *class,
+				    struct class_attribute *attr,
+				    const char *buf, size_t count)
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_P6);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
+	struct list_head *iter = NULL;
+	struct bme280 *device = NULL;
 
-	return ret;
-}
+	u8 adapter_nr;
+	u8 addr;
+	u8 contains = 0;
 
-static ssize_t class_attr_dig_P7_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
-{
-	ssize_t ret;
+	/** Selection is published to lock-free readers of current device */
+	bme280_lock_devices(BME280_ENTRY_i2c_store);
 
-	mutex_lock(&bme280_devices_lock);
+	ret = sscanf(buf, "%hhu 0x%hhx\n", &adapter_nr, &addr);
+	if (ret != 2) {
+		pr_err(THIS_MODULE_NAME
+		       ": invalid argument, try to write i2c adapter number "
+		       " in decimal and device address in hex\n");
 
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
+		ret = -EINVAL;
 		goto err;
 	}
 
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_P7);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
-
-	return ret;
-}
-
-static ssize_t class_attr_dig_P8_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
-{
-	ssize_t ret;
+	list_for_each (iter, &bme280_devices) {
+		device = list_entry(iter, struct bme280, registered);
+		if (adapter_nr == device->client->adapter->nr &&
+		    addr == device->client->addr) {
+			contains = 1;
+			break;
+		}
+	}
 
-	mutex_lock(&bme280_devices_lock);
+	if (contains) {
+		rcu_assign_pointer(bme280_device, device);
+		ret = count;
+	} else {
+		pr_warn(THIS_MODULE_NAME
+			": device with specified i2c adapter number and"
+			" address not found in list of registered devices\n");
 
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
+		ret = -ENODEV;
 	}
 
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_P8);
-
 err:
-	mutex_unlock(&bme280_devices_lock);
+	bme280_unlock_devices();
 
 	return ret;
 }
 
-static ssize_t class_attr_dig_P9_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
-{
-	ssize_t ret;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
+static CLASS_ATTR_RW(i2c, &class_attr_i2c_show, &class_attr_i2c_store);
 
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_P9);
+/********************* Device calibration data (Sysfs) ************************/
 
-err:
-	mutex_unlock(&bme280_devices_lock);
+#ifdef ENABLE_CALIB_DATA_REGS_MAPP
 
-	return ret;
+static ssize_t regs_dig_T1_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_T1);
 }
 
-static ssize_t class_attr_dig_H1_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_dig_T2_show(struct bme280 *device, u64 arrival, char *buf)
 {
-	ssize_t ret;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_H1);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
-
-	return ret;
+	return sprintf(buf, "%d\n", device->calib_data.dig_T2);
 }
 
-static ssize_t class_attr_dig_H2_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_dig_T3_show(struct bme280 *device, u64 arrival, char *buf)
 {
-	ssize_t ret;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_H2);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
-
-	return ret;
+	return sprintf(buf, "%d\n", device->calib_data.dig_T3);
 }
 
-static ssize_t class_attr_dig_H3_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_dig_P1_show(struct bme280 *device, u64 arrival, char *buf)
 {
-	ssize_t ret;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_H3);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
-
-	return ret;
+	return sprintf(buf, "%d\n", device->calib_data.dig_P1);
 }
 
-static ssize_t class_attr_dig_H4_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_dig_P2_show(struct bme280 *device, u64 arrival, char *buf)
 {
-	ssize_t ret;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_H4);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
+	return sprintf(buf, "%d\n", device->calib_data.dig_P2);
+}
 
-	return ret;
+static ssize_t regs_dig_P3_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_P3);
 }
 
-static ssize_t class_attr_dig_H5_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_dig_P4_show(struct bme280 *device, u64 arrival, char *buf)
 {
-	ssize_t ret;
+	return sprintf(buf, "%d\n", device->calib_data.dig_P4);
+}
 
-	mutex_lock(&bme280_devices_lock);
+static ssize_t regs_dig_P5_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_P5);
+}
 
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
+static ssize_t regs_dig_P6_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_P6);
+}
 
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_H5);
+static ssize_t regs_dig_P7_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_P7);
+}
 
-err:
-	mutex_unlock(&bme280_devices_lock);
+static ssize_t regs_dig_P8_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_P8);
+}
 
-	return ret;
+static ssize_t regs_dig_P9_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_P9);
 }
 
-static ssize_t class_attr_dig_H6_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_dig_H1_show(struct bme280 *device, u64 arrival, char *buf)
 {
-	ssize_t ret;
+	return sprintf(buf, "%d\n", device->calib_data.dig_H1);
+}
 
-	mutex_lock(&bme280_devices_lock);
+static ssize_t regs_dig_H2_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_H2);
+}
 
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
+static ssize_t regs_dig_H3_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_H3);
+}
 
-	ret = sprintf(buf, "%d\n", bme280_device->calib_data.dig_H6);
+static ssize_t regs_dig_H4_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_H4);
+}
 
-err:
-	mutex_unlock(&bme280_devices_lock);
+static ssize_t regs_dig_H5_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_H5);
+}
 
-	return ret;
+static ssize_t regs_dig_H6_show(struct bme280 *device, u64 arrival, char *buf)
+{
+	return sprintf(buf, "%d\n", device->calib_data.dig_H6);
 }
 
-static CLASS_ATTR_RO(dig_T1, &class_attr_dig_T1_show);
-static CLASS_ATTR_RO(dig_T2, &class_attr_dig_T2_show);
-static CLASS_ATTR_RO(dig_T3, &class_attr_dig_T3_show);
-static CLASS_ATTR_RO(dig_P1, &class_attr_dig_P1_show);
-static CLASS_ATTR_RO(dig_P2, &class_attr_dig_P2_show);
-static CLASS_ATTR_RO(dig_P3, &class_attr_dig_P3_show);
-static CLASS_ATTR_RO(dig_P4, &class_attr_dig_P4_show);
-static CLASS_ATTR_RO(dig_P5, &class_attr_dig_P5_show);
-static CLASS_ATTR_RO(dig_P6, &class_attr_dig_P6_show);
-static CLASS_ATTR_RO(dig_P7, &class_attr_dig_P7_show);
-static CLASS_ATTR_RO(dig_P8, &class_attr_dig_P8_show);
-static CLASS_ATTR_RO(dig_P9, &class_attr_dig_P9_show);
-static CLASS_ATTR_RO(dig_H1, &class_attr_dig_H1_show);
-static CLASS_ATTR_RO(dig_H2, &class_attr_dig_H2_show);
-static CLASS_ATTR_RO(dig_H3, &class_attr_dig_H3_show);
-static CLASS_ATTR_RO(dig_H4, &class_attr_dig_H4_show);
-static CLASS_ATTR_RO(dig_H5, &class_attr_dig_H5_show);
-static CLASS_ATTR_RO(dig_H6, &class_attr_dig_H6_show);
+CALIB_ATTR_RO(dig_T1);
+CALIB_ATTR_RO(dig_T2);
+CALIB_ATTR_RO(dig_T3);
+CALIB_ATTR_RO(dig_P1);
+CALIB_ATTR_RO(dig_P2);
+CALIB_ATTR_RO(dig_P3);
+CALIB_ATTR_RO(dig_P4);
+CALIB_ATTR_RO(dig_P5);
+CALIB_ATTR_RO(dig_P6);
+CALIB_ATTR_RO(dig_P7);
+CALIB_ATTR_RO(dig_P8);
+CALIB_ATTR_RO(dig_P9);
+CALIB_ATTR_RO(dig_H1);
+CALIB_ATTR_RO(dig_H2);
+CALIB_ATTR_RO(dig_H3);
+CALIB_ATTR_RO(dig_H4);
+CALIB_ATTR_RO(dig_H5);
+CALIB_ATTR_RO(dig_H6);
 
 #endif /* ENABLE_CALIB_DATA_REGS_MAPP */
 
 /************************ Device identifier (Sysfs) ***************************/
 
-static ssize_t class_attr_chip_id_show(struct class *class,
-				       struct class_attribute *attr, char *buf)
+static ssize_t regs_chip_id_show(struct bme280 *device, u64 arrival, char *buf)
 {
-	ssize_t ret;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = sprintf(buf, "0x%x\n", bme280_device->chip_id);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
-
-	return ret;
+	return sprintf(buf, "0x%x\n", device->chip_id);
 }
 
-static CLASS_ATTR_RO(chip_id, &class_attr_chip_id_show);
+REGS_ATTR_RO(chip_id);
 
 /************************** Device commands (Sysfs) ***************************/
 
-static ssize_t class_attr_reset_store(struct class *class,
-				      struct class_attribute *attr,
-				      const char *buf, size_t count)
+static ssize_t regs_reset_store(struct bme280 *device, const char *buf,
+				size_t count)
 {
 	ssize_t ret;
 
 	u8 command;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
 	ret = sscanf(buf, "0x%hhx\n", &command);
 	if (ret != 1) {
 		pr_err(THIS_MODULE_NAME
@@ -582,34 +544,24 @@ static ssize_t class_attr_reset_store(struct class *class,
 		goto err;
 	}
 
-	bme280_soft_reset(bme280_device);
+	bme280_soft_reset(device);
 	ret = count;
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static CLASS_ATTR_WO(reset, &class_attr_reset_store);
+REGS_ATTR_WO(reset);
 
 /************************* Device settings (Sysfs) ****************************/
 
-static ssize_t class_attr_mode_show(struct class *class,
-				    struct class_attribute *attr, char *buf)
+static ssize_t regs_mode_show(struct bme280 *device, u64 arrival, char *buf)
 {
 	ssize_t ret;
 
 	u8 sensor_mode;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = bme280_get_sensor_mode(bme280_device, &sensor_mode);
+	ret = bme280_get_sensor_mode(device, &sensor_mode);
 	if (ret != BME280_OK) {
 		pr_err(THIS_MODULE_NAME
 		       ": failed to get power mode from sensor,"
@@ -621,26 +573,16 @@ static ssize_t class_attr_mode_show(struct class *class,
 	ret = sprintf(buf, "0x%x\n", sensor_mode);
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_mode_store(struct class *class,
-				     struct class_attribute *attr,
-				     const char *buf, size_t count)
+static ssize_t regs_mode_store(struct bme280 *device, const char *buf,
+			       size_t count)
 {
 	ssize_t ret;
 
 	u8 sensor_mode;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
 	ret = sscanf(buf, "0x%hhx\n", &sensor_mode);
 	if (ret != 1) {
 		pr_err(THIS_MODULE_NAME ": invalid argument, try to write"
@@ -653,8 +595,23 @@ static ssize_t class_attr_mode_store(struct class *class,
 	switch (sensor_mode) {
 	case BME280_SLEEP_MODE:
 	case BME280_FORCED_MODE:
+		ret = bme280_stop_sampler(device);
+		if ((ret == BME280_OK) && (sensor_mode == BME280_FORCED_MODE)) {
+			ret = bme280_set_sensor_mode(device, sensor_mode);
+		}
+
+		if (ret != BME280_OK) {
+			pr_err(THIS_MODULE_NAME
+			       ": failed to set power mode to sensor,"
+			       " try again later\n");
+
+			goto err;
+		}
+
+		break;
 	case BME280_NORMAL_MODE:
-		ret = bme280_set_sensor_mode(bme280_device, sensor_mode);
+		/** Normal mode is owned by sampler */
+		ret = bme280_start_sampler(device);
 		if (ret != BME280_OK) {
 			pr_err(THIS_MODULE_NAME
 			       ": failed to set power mode to sensor,"
@@ -678,24 +635,14 @@ static ssize_t class_attr_mode_store(struct class *class,
 	ret = count;
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_osrs_p_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_osrs_p_show(struct bme280 *device, u64 arrival, char *buf)
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = bme280_get_sensor_settings(bme280_device);
+	ret = bme280_get_sensor_settings(device);
 	if (ret != BME280_OK) {
 		pr_err(THIS_MODULE_NAME
 		       ": failed to get pressure oversampling from sensor,"
@@ -704,29 +651,19 @@ static ssize_t class_attr_osrs_p_show(struct class *class,
 		goto err;
 	}
 
-	ret = sprintf(buf, "0x%x\n", bme280_device->settings.osrs_p);
+	ret = sprintf(buf, "0x%x\n", device->settings.osrs_p);
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_osrs_p_store(struct class *class,
-				       struct class_attribute *attr,
-				       const char *buf, size_t count)
+static ssize_t regs_osrs_p_store(struct bme280 *device, const char *buf,
+				 size_t count)
 {
 	ssize_t ret;
 
 	u8 osrs_p;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
 	ret = sscanf(buf, "0x%hhx\n", &osrs_p);
 	if (ret != 1) {
 		pr_err(THIS_MODULE_NAME ": invalid argument, try to write"
@@ -743,10 +680,9 @@ static ssize_t class_attr_osrs_p_store(struct class *class,
 	case BME280_OVERSAMPLING_4X:
 	case BME280_OVERSAMPLING_8X:
 	case BME280_OVERSAMPLING_16X:
-		bme280_device->settings.osrs_p = osrs_p;
+		device->settings.osrs_p = osrs_p;
 
-		ret = bme280_set_sensor_settings(bme280_device,
-						 BME280_OSRS_PRESS_SEL);
+		ret = bme280_set_sensor_settings(device, BME280_OSRS_PRESS_SEL);
 		if (ret != BME280_OK) {
 			pr_err(THIS_MODULE_NAME
 			       ": failed to set pressure oversampling to"
@@ -771,24 +707,14 @@ static ssize_t class_attr_osrs_p_store(struct class *class,
 	ret = count;
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_osrs_t_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_osrs_t_show(struct bme280 *device, u64 arrival, char *buf)
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = bme280_get_sensor_settings(bme280_device);
+	ret = bme280_get_sensor_settings(device);
 	if (ret != BME280_OK) {
 		pr_err(THIS_MODULE_NAME
 		       ": failed to get temperature oversampling from sensor,"
@@ -797,29 +723,19 @@ static ssize_t class_attr_osrs_t_show(struct class *class,
 		goto err;
 	}
 
-	ret = sprintf(buf, "0x%x\n", bme280_device->settings.osrs_t);
+	ret = sprintf(buf, "0x%x\n", device->settings.osrs_t);
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_osrs_t_store(struct class *class,
-				       struct class_attribute *attr,
-				       const char *buf, size_t count)
+static ssize_t regs_osrs_t_store(struct bme280 *device, const char *buf,
+				 size_t count)
 {
 	ssize_t ret;
 
 	u8 osrs_t;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
 	ret = sscanf(buf, "0x%hhx\n", &osrs_t);
 	if (ret != 1) {
 		pr_err(THIS_MODULE_NAME ": invalid argument, try to write"
@@ -836,10 +752,9 @@ static ssize_t class_attr_osrs_t_store(struct class *class,
 	case BME280_OVERSAMPLING_4X:
 	case BME280_OVERSAMPLING_8X:
 	case BME280_OVERSAMPLING_16X:
-		bme280_device->settings.osrs_t = osrs_t;
+		device->settings.osrs_t = osrs_t;
 
-		ret = bme280_set_sensor_settings(bme280_device,
-						 BME280_OSRS_TEMP_SEL);
+		ret = bme280_set_sensor_settings(device, BME280_OSRS_TEMP_SEL);
 		if (ret != BME280_OK) {
 			pr_err(THIS_MODULE_NAME
 			       ": failed to set temperature oversampling to"
@@ -864,24 +779,14 @@ static ssize_t class_attr_osrs_t_store(struct class *class,
 	ret = count;
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_osrs_h_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_osrs_h_show(struct bme280 *device, u64 arrival, char *buf)
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = bme280_get_sensor_settings(bme280_device);
+	ret = bme280_get_sensor_settings(device);
 	if (ret != BME280_OK) {
 		pr_err(THIS_MODULE_NAME
 		       ": failed to get humidity oversampling from sensor,"
@@ -890,29 +795,19 @@ static ssize_t class_attr_osrs_h_show(struct class *class,
 		goto err;
 	}
 
-	ret = sprintf(buf, "0x%x\n", bme280_device->settings.osrs_h);
+	ret = sprintf(buf, "0x%x\n", device->settings.osrs_h);
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_osrs_h_store(struct class *class,
-				       struct class_attribute *attr,
-				       const char *buf, size_t count)
+static ssize_t regs_osrs_h_store(struct bme280 *device, const char *buf,
+				 size_t count)
 {
 	ssize_t ret;
 
 	u8 osrs_h;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
 	ret = sscanf(buf, "0x%hhx\n", &osrs_h);
 	if (ret != 1) {
 		pr_err(THIS_MODULE_NAME ": invalid argument, try to write "
@@ -929,10 +824,9 @@ static ssize_t class_attr_osrs_h_store(struct class *class,
 	case BME280_OVERSAMPLING_4X:
 	case BME280_OVERSAMPLING_8X:
 	case BME280_OVERSAMPLING_16X:
-		bme280_device->settings.osrs_h = osrs_h;
+		device->settings.osrs_h = osrs_h;
 
-		ret = bme280_set_sensor_settings(bme280_device,
-						 BME280_OSRS_HUM_SEL);
+		ret = bme280_set_sensor_settings(device, BME280_OSRS_HUM_SEL);
 		if (ret != BME280_OK) {
 			pr_err(THIS_MODULE_NAME
 			       ": failed to set humidity oversampling to"
@@ -957,24 +851,14 @@ static ssize_t class_attr_osrs_h_store(struct class *class,
 	ret = count;
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_filter_show(struct class *class,
-				      struct class_attribute *attr, char *buf)
+static ssize_t regs_filter_show(struct bme280 *device, u64 arrival, char *buf)
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = bme280_get_sensor_settings(bme280_device);
+	ret = bme280_get_sensor_settings(device);
 	if (ret != BME280_OK) {
 		pr_err(THIS_MODULE_NAME
 		       ": failed to get filter coefficient from sensor,"
@@ -983,29 +867,19 @@ static ssize_t class_attr_filter_show(struct class *class,
 		goto err;
 	}
 
-	ret = sprintf(buf, "0x%x\n", bme280_device->settings.filter);
+	ret = sprintf(buf, "0x%x\n", device->settings.filter);
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_filter_store(struct class *class,
-				       struct class_attribute *attr,
-				       const char *buf, size_t count)
+static ssize_t regs_filter_store(struct bme280 *device, const char *buf,
+				 size_t count)
 {
 	ssize_t ret;
 
 	u8 filter;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
 	ret = sscanf(buf, "0x%hhx\n", &filter);
 	if (ret != 1) {
 		pr_err(THIS_MODULE_NAME ": invalid argument, try to write "
@@ -1021,10 +895,9 @@ static ssize_t class_attr_filter_store(struct class *class,
 	case BME280_FILTER_COEFF_4:
 	case BME280_FILTER_COEFF_8:
 	case BME280_FILTER_COEFF_16:
-		bme280_device->settings.filter = filter;
+		device->settings.filter = filter;
 
-		ret = bme280_set_sensor_settings(bme280_device,
-						 BME280_FILTER_SEL);
+		ret = bme280_set_sensor_settings(device, BME280_FILTER_SEL);
 		if (ret != BME280_OK) {
 			pr_err(THIS_MODULE_NAME
 			       ": failed to set filter coefficient to"
@@ -1049,25 +922,15 @@ static ssize_t class_attr_filter_store(struct class *class,
 	ret = count;
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_standby_time_show(struct class *class,
-					    struct class_attribute *attr,
-					    char *buf)
+static ssize_t regs_standby_time_show(struct bme280 *device, u64 arrival,
+				      char *buf)
 {
 	ssize_t ret;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = bme280_get_sensor_settings(bme280_device);
+	ret = bme280_get_sensor_settings(device);
 	if (ret != BME280_OK) {
 		pr_err(THIS_MODULE_NAME
 		       ": failed to get standby time from sensor,"
@@ -1076,29 +939,19 @@ static ssize_t class_attr_standby_time_show(struct class *class,
 		goto err;
 	}
 
-	ret = sprintf(buf, "0x%x\n", bme280_device->settings.standby_time);
+	ret = sprintf(buf, "0x%x\n", device->settings.standby_time);
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static ssize_t class_attr_standby_time_store(struct class *class,
-					     struct class_attribute *attr,
-					     const char *buf, size_t count)
+static ssize_t regs_standby_time_store(struct bme280 *device, const char *buf,
+				       size_t count)
 {
 	ssize_t ret;
 
 	u8 standby_time;
 
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
 	ret = sscanf(buf, "0x%hhx\n", &standby_time);
 	if (ret != 1) {
 		pr_err(THIS_MODULE_NAME ": invalid argument, try to write"
@@ -1117,9 +970,9 @@ static ssize_t class_attr_standby_time_store(struct class *class,
 	case BME280_STANDBY_TIME_1000_MS:
 	case BME280_STANDBY_TIME_10_MS:
 	case BME280_STANDBY_TIME_20_MS:
-		bme280_device->settings.standby_time = standby_time;
+		device->settings.standby_time = standby_time;
 
-		ret = bme280_set_sensor_settings(bme280_device,
+		ret = bme280_set_sensor_settings(device,
 						 BME280_STANDBY_TIME_SEL);
 		if (ret != BME280_OK) {
 			pr_err(THIS_MODULE_NAME
@@ -1146,125 +999,94 @@ static ssize_t class_attr_standby_time_store(struct class *class,
 	ret = count;
 
 err:
-	mutex_unlock(&bme280_devices_lock);
-
 	return ret;
 }
 
-static CLASS_ATTR_RW(mode, &class_attr_mode_show, &class_attr_mode_store);
-static CLASS_ATTR_RW(osrs_p, &class_attr_osrs_p_show, &class_attr_osrs_p_store);
-static CLASS_ATTR_RW(osrs_t, &class_attr_osrs_t_show, &class_attr_osrs_t_store);
-static CLASS_ATTR_RW(osrs_h, &class_attr_osrs_h_show, &class_attr_osrs_h_store);
-static CLASS_ATTR_RW(filter, &class_attr_filter_show, &class_attr_filter_store);
-static CLASS_ATTR_RW(standby_time, &class_attr_standby_time_show,
-		     &class_attr_standby_time_store);
+REGS_ATTR_RW(mode);
+REGS_ATTR_RW(osrs_p);
+REGS_ATTR_RW(osrs_t);
+REGS_ATTR_RW(osrs_h);
+REGS_ATTR_RW(filter);
+REGS_ATTR_RW(standby_time);
 
 /********************* Device compensated data (Sysfs) ************************/
 
-static ssize_t class_attr_pressure_show(struct class *class,
-					struct class_attribute *attr, char *buf)
+/**
+ * Latest sample of sampler, or forced measurement when stopped, which is shared
+ * by concurrent requests
+ */
+static ssize_t regs_pressure_show(const struct bme280_sample *sample,
+				  char *buf)
 {
-	ssize_t ret;
-
-	struct bme280_data comp_data;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	/** Use forced mode to put device to sleep after measuring */
-	ret = bme280_get_sensor_data_forced(bme280_device, BME280_PRESS,
-					    &comp_data);
-	if (ret != BME280_OK) {
-		pr_err(THIS_MODULE_NAME
-		       ": failed to get pressure from sesnsor, try again"
-		       " later\n");
-
-		ret = -EAGAIN;
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", comp_data.pressure);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
-
-	return ret;
+	return sprintf(buf, "%d\n", sample->comp_data.pressure);
 }
 
-static ssize_t class_attr_temperature_show(struct class *class,
-					   struct class_attribute *attr,
-					   char *buf)
+static ssize_t regs_temperature_show(const struct bme280_sample *sample,
+				     char *buf)
 {
-	ssize_t ret;
-
-	struct bme280_data comp_data;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = bme280_get_sensor_data_forced(bme280_device, BME280_TEMP,
-					    &comp_data);
-	if (ret != BME280_OK) {
-		pr_err(THIS_MODULE_NAME
-		       ": failed to get temperature from sesnsor, try again"
-		       " later\n");
-
-		ret = -EAGAIN;
-		goto err;
-	}
-
-	ret = sprintf(buf, "%d\n", comp_data.temperature);
-
-err:
-	mutex_unlock(&bme280_devices_lock);
-
-	return ret;
+	return sprintf(buf, "%d\n", sample->comp_data.temperature);
 }
 
-static ssize_t class_attr_humidity_show(struct class *class,
-					struct class_attribute *attr, char *buf)
+static ssize_t regs_humidity_show(const struct bme280_sample *sample,
+				  char *buf)
 {
-	ssize_t ret;
-
-	struct bme280_data comp_data;
-
-	mutex_lock(&bme280_devices_lock);
-
-	ret = bme280_device_null_ptr_check();
-	if (ret != BME280_OK) {
-		goto err;
-	}
-
-	ret = bme280_get_sensor_data_forced(bme280_device, BME280_HUM,
-					    &comp_data);
-	if (ret != BME280_OK) {
-		pr_err(THIS_MODULE_NAME
-		       ": failed to get humidity from sesnsor, try again"
-		       " later\n");
-
-		ret = -EAGAIN;
-		goto err;
-	}
+	return sprintf(buf, "%d\n", sample->comp_data.humidity);
+}
 
-	ret = sprintf(buf, "%d\n", comp_data.humidity);
+/** All channels come from a single conversion and data burst */
+static ssize_t regs_measurements_show(const struct bme280_sample *sample,
+				      char *buf)
+{
+	return sprintf(buf, "%u %d %u %llu\n", sample->comp_data.pressure,
+		       sample->comp_data.temperature,
+		       sample->comp_data.humidity, sample->timestamp);
+}
 
-err:
-	mutex_unlock(&bme280_devices_lock);
+SAMPLE_ATTR_RO(pressure, BME280_PRESS);
+SAMPLE_ATTR_RO(temperature, BME280_TEMP);
+SAMPLE_ATTR_RO(humidity, BME280_HUM);
+SAMPLE_ATTR_RO(measurements, BME280_ALL);
 
-	return ret;
-}
+/************************ Attributes of every device **************************/
 
-static CLASS_ATTR_RO(pressure, &class_attr_pressure_show);
-static CLASS_ATTR_RO(temperature, &class_attr_temperature_show);
-static CLASS_ATTR_RO(humidity, &class_attr_humidity_show);
+static struct attribute *regs_attrs[] = {
+#ifdef ENABLE_CALIB_DATA_REGS_MAPP
+	&dev_attr_dig_T1.attr,
+	&dev_attr_dig_T2.attr,
+	&dev_attr_dig_T3.attr,
+	&dev_attr_dig_P1.attr,
+	&dev_attr_dig_P2.attr,
+	&dev_attr_dig_P3.attr,
+	&dev_attr_dig_P4.attr,
+	&dev_attr_dig_P5.attr,
+	&dev_attr_dig_P6.attr,
+	&dev_attr_dig_P7.attr,
+	&dev_attr_dig_P8.attr,
+	&dev_attr_dig_P9.attr,
+	&dev_attr_dig_H1.attr,
+	&dev_attr_dig_H2.attr,
+	&dev_attr_dig_H3.attr,
+	&dev_attr_dig_H4.attr,
+	&dev_attr_dig_H5.attr,
+	&dev_attr_dig_H6.attr,
+#endif /* ENABLE_CALIB_DATA_REGS_MAPP */
+	&dev_attr_chip_id.attr,
+	&dev_attr_reset.attr,
+	&dev_attr_mode.attr,
+	&dev_attr_osrs_p.attr,
+	&dev_attr_osrs_t.attr,
+	&dev_attr_osrs_h.attr,
+	&dev_attr_filter.attr,
+	&dev_attr_standby_time.attr,
+	&dev_attr_pressure.attr,
+	&dev_attr_temperature.attr,
+	&dev_attr_humidity.attr,
+	&dev_attr_measurements.attr,
+	NULL
+};
+
+/** Attached to every device along with attributes of its ring of samples */
+const struct attribute_group bme280_regs_attr_group = { .attrs = regs_attrs };
 
 /***************************** Public Functions *******************************/
 
@@ -1560,8 +1382,19 @@ ssize_t bme280_create_regs_mapp(void)
 		goto remove_class_attr_temperature;
 	}
 
+	ret = class_create_file(class_bme280, &class_attr_measurements);
+	if (ret) {
+		pr_err(THIS_MODULE_NAME ": failed to create class attribute "
+					" 'measurements' in /sys\n");
+
+		ret = -ENOENT;
+		goto remove_class_attr_humidity;
+	}
+
 	return 0;
 
+remove_class_attr_humidity:
+	class_remove_file(class_bme280, &class_attr_humidity);
 remove_class_attr_temperature:
 	class_remove_file(class_bme280, &class_attr_temperature);
 remove_class_attr_pressure:
@@ -1634,6 +1467,7 @@ err:
 
 void bme280_remove_regs_mapp(void)
 {
+	class_remove_file(class_bme280, &class_attr_measurements);
 	class_remove_file(class_bme280, &class_attr_humidity);
 	class_remove_file(class_bme280, &class_attr_temperature);
 	class_remove_file(class_bme280, &class_attr_pressure);
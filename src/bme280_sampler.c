@@ -0,0 +1,628 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/timekeeping.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+#include <linux/kfifo.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+
+#include <module.h>
+#include <bme280.h>
+#include <bme280_sampler.h>
+#include <bme280_dev_mapp.h>
+#include <bme280_trace.h>
+
+/***************************** Module Parameters ******************************/
+
+static unsigned int ring_depth = BME280_RING_DEFAULT_DEPTH;
+module_param(ring_depth, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(ring_depth, "Depth of sample ring for newly registered "
+			     "devices, rounded up to power of two");
+
+/** Slack of the single wait for conversions of many devices, in microseconds */
+#define FLEET_WAIT_SLACK_US 1000
+
+/** Maximum number of devices read by a single transfer on one adapter */
+#define FLEET_GROUP_MAX 8
+
+/** Result of a device whose conversion is started but not collected yet */
+#define FLEET_PENDING INT_MAX
+
+/***************************** Global Variables *******************************/
+
+/**
+ * Fleet reads lock several devices at once, serializing them makes nesting of
+ * device locks safe
+ */
+static DEFINE_MUTEX(fleet_lock);
+
+/***************************** Common Functions *******************************/
+
+static inline unsigned long sample_period(const struct bme280 *self)
+{
+	return usecs_to_jiffies(bme280_calc_standby_time(&self->settings) +
+				bme280_calc_meas_time(&self->settings));
+}
+
+/** Monotonic time of the predicted end of the started forced conversion */
+static inline u64 conversion_deadline(const struct bme280 *self)
+{
+	return self->triggered +
+	       (u64)bme280_calc_meas_time(&self->settings) * NSEC_PER_USEC;
+}
+
+/**
+ * Conversion which ended longer than the staleness bound before the request
+ * arrived is not collected. Without pipelining the bound is zero, so only a
+ * conversion in flight is collected
+ */
+static inline bool is_conversion_stale(const struct bme280 *self, u64 arrival)
+{
+	return arrival >
+	       conversion_deadline(self) + (u64)self->pipeline * NSEC_PER_MSEC;
+}
+
+static ssize_t trigger_conversion(struct bme280 *self)
+{
+	ssize_t ret;
+
+	ret = bme280_trigger_forced_mode(self);
+	if (ret != BME280_OK) {
+		goto err;
+	}
+
+	self->converting = true;
+	self->triggered = ktime_get_ns();
+
+err:
+	return ret;
+}
+
+/** Snapshot holds the data registers of the finished forced conversion */
+static ssize_t collect_conversion(struct bme280 *self, u8 sensor_comp,
+				  u64 arrival,
+				  const struct bme280_snapshot *snapshot,
+				  struct bme280_sample *sample)
+{
+	ssize_t ret;
+
+	u64 now;
+
+	self->converting = false;
+	self->conversions++;
+
+	ret = bme280_compensate_data(sensor_comp, &snapshot->uncomp_data,
+				     &self->sample.comp_data,
+				     &self->calib_data);
+	if (ret != BME280_OK) {
+		goto err;
+	}
+
+	/** Pipelined conversion ended before the request, data is that old */
+	now = ktime_get_ns();
+	self->sample.timestamp =
+		self->triggered < arrival ?
+			min_t(u64, now, conversion_deadline(self)) :
+			now;
+	self->sample.uncomp_data = snapshot->uncomp_data;
+	self->sample_comp = sensor_comp;
+
+	*sample = self->sample;
+
+	/** Next conversion runs while nobody waits for it */
+	if (self->pipeline) {
+		trigger_conversion(self);
+	}
+
+err:
+	return ret;
+}
+
+/**
+ * Request is served by the started conversion, otherwise bme280_get_sample
+ * shares a sample or starts a new conversion
+ */
+static inline bool is_conversion_collectable(const struct bme280 *self,
+					     u64 arrival)
+{
+	return !self->sampling && (self->sample.timestamp < arrival) &&
+	       self->converting && !is_conversion_stale(self, arrival);
+}
+
+static inline u32 clamp_ring_depth(u32 depth)
+{
+	return clamp_t(u32, depth, BME280_RING_MIN_DEPTH,
+		       BME280_RING_MAX_DEPTH);
+}
+
+static ssize_t store_sample(struct bme280 *self,
+			    const struct bme280_snapshot *snapshot)
+{
+	ssize_t ret;
+
+	struct bme280_record record;
+
+	ret = bme280_compensate_data(BME280_ALL, &snapshot->uncomp_data,
+				     &self->sample.comp_data,
+				     &self->calib_data);
+	if (ret != BME280_OK) {
+		goto err;
+	}
+
+	self->sample.timestamp = ktime_get_ns();
+	self->sample.uncomp_data = snapshot->uncomp_data;
+	self->sample_comp = BME280_ALL;
+
+	record.timestamp = self->sample.timestamp;
+	record.sequence = self->sequence++;
+	record.uncomp_pressure = snapshot->uncomp_data.pressure;
+	record.uncomp_temperature = snapshot->uncomp_data.temperature;
+	record.uncomp_humidity = snapshot->uncomp_data.humidity;
+	record.pressure = self->sample.comp_data.pressure;
+	record.temperature = self->sample.comp_data.temperature;
+	record.humidity = self->sample.comp_data.humidity;
+	record.reserved = 0;
+
+	/** Sampler never waits for readers, overflowed samples are dropped */
+	if (!kfifo_put(&self->ring, record)) {
+		self->dropped++;
+	}
+
+	if (kfifo_len(&self->ring) >= self->watermark) {
+		atomic_inc(&self->samples_generation);
+		wake_up_interruptible_poll(&self->samples_wait,
+					   EPOLLIN | EPOLLRDNORM);
+	}
+
+	bme280_notify_dev_mapp(self);
+
+err:
+	return ret;
+}
+
+/***************************** Sampling Work **********************************/
+
+static void sampler_work(struct work_struct *work)
+{
+	ssize_t ret;
+
+	struct bme280 *self =
+		container_of(to_delayed_work(work), struct bme280, sampler);
+	struct bme280_snapshot snapshot;
+	unsigned long delay;
+
+	bme280_lock_device(self, BME280_ENTRY_sampler);
+
+	if (!self->sampling) {
+		goto unlock_device;
+	}
+
+	delay = sample_period(self);
+
+	ret = bme280_get_snapshot(self, &snapshot);
+	if (ret != BME280_OK) {
+		goto reschedule;
+	}
+
+	/** Changing settings puts the device to sleep, resume normal mode */
+	if (snapshot.mode != BME280_NORMAL_MODE) {
+		ret = bme280_set_sensor_mode(self, BME280_NORMAL_MODE);
+		delay = usecs_to_jiffies(bme280_calc_meas_time(&self->settings));
+		goto reschedule;
+	}
+
+	ret = store_sample(self, &snapshot);
+
+reschedule:
+	if (ret != BME280_OK) {
+		pr_warn_ratelimited(THIS_MODULE_NAME
+				    ": failed to sample device at %s-%d 0x%x\n",
+				    self->client->adapter->dev.of_node->name,
+				    self->client->adapter->nr,
+				    self->client->addr);
+	}
+
+	schedule_delayed_work(&self->sampler, delay);
+unlock_device:
+	bme280_unlock_device(self);
+}
+
+/******************************* Fleet Reads **********************************/
+
+static bool is_in_group(struct bme280 **devices, const size_t *group, u8 count,
+			const struct bme280 *device)
+{
+	u8 k;
+
+	for (k = 0; k < count; k++) {
+		if (devices[group[k]] == device) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Devices of the group are on the same adapter, their conversions are collected
+ * by a single transfer. Devices which aren't served by the started conversion,
+ * or whose conversion is still running, are sampled one by one.
+ *
+ * Locks of devices were dropped since their conversions were triggered, so a
+ * soft reset or a settings store may have aborted a conversion, or another
+ * request may have started a later one. Both are re-checked under the lock,
+ * lost conversions are triggered again and the batch waits for the latest one
+ */
+static void collect_group(struct bme280 **devices, const size_t *group,
+			  u8 count, u8 sensor_comp, u64 arrival,
+			  struct bme280_sample *samples, ssize_t *results)
+{
+	ssize_t ret = BME280_E_COMM_FAIL;
+
+	struct bme280 *batch[FLEET_GROUP_MAX];
+	struct bme280_snapshot snapshots[FLEET_GROUP_MAX];
+	size_t indexes[FLEET_GROUP_MAX];
+	union bme280_status status;
+	struct bme280 *device;
+	u64 deadline = 0;
+	u64 now;
+	u32 wait;
+	size_t i;
+	u8 n = 0;
+	u8 k;
+
+	mutex_lock(&fleet_lock);
+
+	for (k = 0; k < count; k++) {
+		i = group[k];
+		device = devices[i];
+
+		bme280_lock_device_nest(device, BME280_ENTRY_batch_read,
+					&fleet_lock);
+
+		if (device->removed) {
+			results[i] = -ENODEV;
+			continue;
+		}
+
+		/** Conversion was lost since the trigger, start it again */
+		if (!device->converting) {
+			results[i] = bme280_start_sample(device, arrival);
+			if (results[i] != BME280_OK) {
+				continue;
+			}
+		}
+
+		if (is_conversion_collectable(device, arrival)) {
+			deadline = max_t(u64, deadline,
+					 conversion_deadline(device));
+			batch[n] = device;
+			indexes[n++] = i;
+		} else {
+			results[i] = bme280_get_sample(device, sensor_comp,
+						       arrival, &samples[i]);
+		}
+	}
+
+	/** Re-triggered or restarted conversions end later than predicted */
+	now = ktime_get_ns();
+	if ((n > 1) && (deadline > now)) {
+		wait = div_u64(deadline - now, NSEC_PER_USEC);
+		usleep_range(wait, wait + FLEET_WAIT_SLACK_US);
+	}
+
+	/** Adapter is locked once for data registers of all devices */
+	if (n > 1) {
+		ret = bme280_get_snapshots(batch, n, snapshots);
+	}
+
+	for (k = 0; k < n; k++) {
+		i = indexes[k];
+		if (ret == BME280_OK) {
+			status.reg = snapshots[k].status;
+			atomic_inc(&batch[k]->stats->status_polls);
+		}
+
+		if ((ret != BME280_OK) || status.measuring) {
+			results[i] = bme280_get_sample(batch[k], sensor_comp,
+						       arrival, &samples[i]);
+		} else {
+			bme280_hist_add(&batch[k]->stats->conversions,
+					ktime_get_ns() - batch[k]->triggered);
+
+			if (trace_bme280_conversion_done_enabled()) {
+				trace_bme280_conversion_done(
+					batch[k],
+					ktime_get_ns() - batch[k]->triggered,
+					BME280_OK);
+			}
+
+			results[i] = collect_conversion(batch[k], sensor_comp,
+							arrival, &snapshots[k],
+							&samples[i]);
+		}
+	}
+
+	for (k = count; k > 0; k--) {
+		bme280_unlock_device(devices[group[k - 1]]);
+	}
+
+	mutex_unlock(&fleet_lock);
+}
+
+/***************************** Public Functions *******************************/
+
+ssize_t bme280_init_sampler(struct bme280 *self)
+{
+	ssize_t ret;
+
+	INIT_DELAYED_WORK(&self->sampler, sampler_work);
+	self->sampling = false;
+	self->converting = false;
+	self->sample.timestamp = 0;
+	self->sequence = 0;
+	self->dropped = 0;
+	self->watermark = 1;
+	init_waitqueue_head(&self->samples_wait);
+	atomic_set(&self->samples_generation, 0);
+
+	ret = kfifo_alloc(&self->ring, clamp_ring_depth(ring_depth),
+			  GFP_KERNEL);
+	if (ret) {
+		ret = -ENOMEM;
+	}
+
+	return ret;
+}
+
+void bme280_deinit_sampler(struct bme280 *self)
+{
+	kfifo_free(&self->ring);
+}
+
+ssize_t bme280_set_ring_depth(struct bme280 *self, u32 depth)
+{
+	ssize_t ret;
+
+	DECLARE_KFIFO_PTR(ring, struct bme280_record);
+
+	ret = kfifo_alloc(&ring, clamp_ring_depth(depth), GFP_KERNEL);
+	if (ret) {
+		return -ENOMEM;
+	}
+
+	/** Samples of the previous ring are discarded */
+	kfifo_free(&self->ring);
+	memcpy(&self->ring, &ring, sizeof(ring));
+
+	self->watermark = min_t(u32, self->watermark, kfifo_size(&self->ring));
+
+	return 0;
+}
+
+ssize_t bme280_start_sampler(struct bme280 *self)
+{
+	ssize_t ret;
+
+	struct bme280_snapshot snapshot;
+
+	if (self->sampling) {
+		return BME280_OK;
+	}
+
+	/** Conversion in flight is taken over by the seeding one */
+	self->converting = false;
+
+	ret = bme280_get_snapshot_forced(self, &snapshot);
+	if (ret != BME280_OK) {
+		goto err;
+	}
+
+	ret = store_sample(self, &snapshot);
+	if (ret != BME280_OK) {
+		goto err;
+	}
+
+	ret = bme280_set_sensor_mode(self, BME280_NORMAL_MODE);
+	if (ret != BME280_OK) {
+		goto err;
+	}
+
+	self->sampling = true;
+	schedule_delayed_work(&self->sampler, sample_period(self));
+
+err:
+	return ret;
+}
+
+ssize_t bme280_stop_sampler(struct bme280 *self)
+{
+	/** Putting the device to sleep aborts a pipelined conversion */
+	self->converting = false;
+
+	if (self->sampling) {
+		/** Running work sees the flag and doesn't reschedule itself */
+		self->sampling = false;
+		cancel_delayed_work(&self->sampler);
+
+		/** Ring is not filled anymore, readers drain it or give up */
+		atomic_inc(&self->samples_generation);
+		wake_up_interruptible_poll(&self->samples_wait,
+					   EPOLLIN | EPOLLERR);
+	}
+
+	return bme280_set_sensor_mode(self, BME280_SLEEP_MODE);
+}
+
+void bme280_cancel_sampler(struct bme280 *self)
+{
+	if (self == NULL) {
+		return;
+	}
+
+	cancel_delayed_work_sync(&self->sampler);
+}
+
+ssize_t bme280_start_sample(struct bme280 *self, u64 arrival)
+{
+	if (self->sampling || (self->sample.timestamp >= arrival)) {
+		return BME280_OK;
+	}
+
+	if (self->converting && !is_conversion_stale(self, arrival)) {
+		return BME280_OK;
+	}
+
+	return trigger_conversion(self);
+}
+
+ssize_t bme280_get_sample(struct bme280 *self, u8 sensor_comp, u64 arrival,
+			  struct bme280_sample *sample)
+{
+	ssize_t ret;
+
+	struct bme280_snapshot snapshot;
+
+	if (self->sampling) {
+		*sample = self->sample;
+		return BME280_OK;
+	}
+
+	/**
+	 * Conversions run under lock of the device, so a request which arrived
+	 * while one was in flight acquires the lock after it has completed.
+	 * Its result is shared, missing channels are compensated from the same
+	 * raw data with the merged channel mask.
+	 */
+	if (self->sample.timestamp >= arrival) {
+		self->coalesced++;
+
+		if ((self->sample_comp & sensor_comp) != sensor_comp) {
+			ret = bme280_compensate_data(
+				self->sample_comp | sensor_comp,
+				&self->sample.uncomp_data,
+				&self->sample.comp_data, &self->calib_data);
+			if (ret != BME280_OK) {
+				goto err;
+			}
+
+			self->sample_comp |= sensor_comp;
+		}
+
+		*sample = self->sample;
+		return BME280_OK;
+	}
+
+	/**
+	 * Conversion started by bme280_start_sample or pipelined by the
+	 * previous request is collected here, unless it is stale
+	 */
+	ret = bme280_start_sample(self, arrival);
+	if (ret != BME280_OK) {
+		goto err;
+	}
+
+	self->converting = false;
+
+	ret = bme280_get_snapshot_triggered(self, self->triggered, &snapshot);
+	if (ret != BME280_OK) {
+		goto err;
+	}
+
+	ret = collect_conversion(self, sensor_comp, arrival, &snapshot, sample);
+
+err:
+	return ret;
+}
+
+ssize_t bme280_get_raw_sample(struct bme280 *self, u64 arrival,
+			      struct bme280_sample *sample,
+			      struct bme280_calib_data *calib_data)
+{
+	ssize_t ret;
+
+	/** No channel is compensated under lock, coalesced requests do it */
+	ret = bme280_get_sample(self, 0, arrival, sample);
+	if (ret == BME280_OK) {
+		*calib_data = self->calib_data;
+	}
+
+	return ret;
+}
+
+void bme280_sample_devices(struct bme280 **devices, size_t count,
+			   u8 sensor_comp, u64 arrival,
+			   struct bme280_sample *samples, ssize_t *results)
+{
+	struct bme280 *device;
+	size_t group[FLEET_GROUP_MAX];
+	u64 deadline = 0;
+	u64 now;
+	u32 wait;
+	size_t i;
+	size_t j;
+	u8 n;
+
+	/** Forced mode is written to every device back to back */
+	for (i = 0; i < count; i++) {
+		device = devices[i];
+		if (device == NULL) {
+			results[i] = -ENODEV;
+			continue;
+		}
+
+		bme280_lock_device(device, BME280_ENTRY_batch_read);
+
+		if (device->removed) {
+			results[i] = -ENODEV;
+		} else {
+			results[i] = bme280_start_sample(device, arrival);
+			if (results[i] == BME280_OK) {
+				results[i] = FLEET_PENDING;
+			}
+
+			if ((results[i] == FLEET_PENDING) &&
+			    device->converting) {
+				deadline = max_t(u64, deadline,
+						 conversion_deadline(device));
+			}
+		}
+
+		bme280_unlock_device(device);
+	}
+
+	/** Single wait for the longest predicted measurement time */
+	now = ktime_get_ns();
+	if (deadline > now) {
+		wait = div_u64(deadline - now, NSEC_PER_USEC);
+		usleep_range(wait, wait + FLEET_WAIT_SLACK_US);
+	}
+
+	/**
+	 * Conversions are done, so data registers are read without waiting.
+	 * Pending devices are grouped by adapter, every device once per group
+	 */
+	for (i = 0; i < count; i++) {
+		if (results[i] != FLEET_PENDING) {
+			continue;
+		}
+
+		n = 0;
+		for (j = i; (j < count) && (n < FLEET_GROUP_MAX); j++) {
+			if ((results[j] == FLEET_PENDING) &&
+			    (devices[j]->adapter == devices[i]->adapter) &&
+			    !is_in_group(devices, group, n, devices[j])) {
+				group[n++] = j;
+			}
+		}
+
+		collect_group(devices, group, n, sensor_comp, arrival, samples,
+			      results);
+	}
+}
@@ -1,20 +1,192 @@
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/i2c.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/rcupdate.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/timekeeping.h>
 
 #include <module.h>
 #include <bme280.h>
 #include <bme280_regs_mapp.h>
 #include <bme280_info_mapp.h>
+#include <bme280_debug_mapp.h>
+#include <bme280_sampler.h>
+#include <bme280_dev_mapp.h>
+#include <bme280_ctl_mapp.h>
+#include <bme280_iio_mapp.h>
+#include <bme280_trace.h>
+
+/***************************** Module Parameters ******************************/
+
+static unsigned int pressure_precision = BME280_PRESS_PRECISION_32;
+module_param(pressure_precision, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(pressure_precision, "Precision of pressure compensation for "
+				     "newly registered devices, 32 or 64 bits");
+
+/***************************** Global Variables *******************************/
 
 /** Pointer to last selected device, all operations perfoms with this device */
-struct bme280 *bme280_device = NULL;
+struct bme280 __rcu *bme280_device = NULL;
 
-/** Linked list to hold registered devices */
+/** RCU protected linked list to hold registered devices */
 LIST_HEAD(bme280_devices);
 
-/** Used for guaranteed sole access to registered devices for this driver */
-struct mutex bme280_devices_lock;
+/**
+ * Serializes updates of the list of registered devices and current selected
+ * device, readers look them up under RCU. Every device is serialized by its
+ * own lock
+ */
+DEFINE_MUTEX(bme280_devices_lock);
+
+/** Wait and hold times of bme280_devices_lock by entry points */
+struct bme280_lock_stats bme280_devices_lock_stats[BME280_ENTRY_MAX];
+
+/** Monotonic time bme280_devices_lock was acquired at */
+static u64 bme280_devices_locked;
+
+/** Entry point holding bme280_devices_lock */
+static enum bme280_entry bme280_devices_locked_entry;
+
+static void bme280_release_device(struct kref *refs)
+{
+	struct bme280 *device = container_of(refs, struct bme280, refs);
+
+	bme280_deinit_sampler(device);
+	bme280_deinit(device);
+	kvfree(device->stats);
+	kfree(device);
+}
+
+void bme280_get_device(struct bme280 *device)
+{
+	kref_get(&device->refs);
+}
+
+void bme280_put_device(struct bme280 *device)
+{
+	kref_put(&device->refs, &bme280_release_device);
+}
+
+void bme280_lock_devices(enum bme280_entry entry)
+{
+	u64 start = ktime_get_ns();
+	u64 wait;
+
+	mutex_lock(&bme280_devices_lock);
+
+	bme280_devices_locked = ktime_get_ns();
+	bme280_devices_locked_entry = entry;
+
+	wait = bme280_devices_locked - start;
+	bme280_lock_stats_wait(&bme280_devices_lock_stats[entry], wait);
+	trace_bme280_devices_lock_acquire(NULL, wait);
+}
+
+void bme280_unlock_devices(void)
+{
+	u64 hold = ktime_get_ns() - bme280_devices_locked;
+
+	bme280_lock_stats_hold(
+		&bme280_devices_lock_stats[bme280_devices_locked_entry], hold);
+
+	mutex_unlock(&bme280_devices_lock);
+
+	trace_bme280_devices_lock_release(NULL, hold);
+}
+
+/** Must be called with lock of the device just acquired */
+static void account_device_lock(struct bme280 *device,
+				enum bme280_entry entry, u64 start)
+{
+	u64 wait;
+
+	device->locked = ktime_get_ns();
+	device->locked_entry = entry;
+
+	wait = device->locked - start;
+	bme280_lock_stats_wait(&device->stats->locks[entry], wait);
+	trace_bme280_device_lock_acquire(device, wait);
+}
+
+void bme280_lock_device(struct bme280 *device, enum bme280_entry entry)
+{
+	u64 start = ktime_get_ns();
+
+	mutex_lock(&device->lock);
+	account_device_lock(device, entry, start);
+}
+
+void bme280_lock_device_nest(struct bme280 *device, enum bme280_entry entry,
+			     struct mutex *nest_lock)
+{
+	u64 start = ktime_get_ns();
+
+	mutex_lock_nest_lock(&device->lock, nest_lock);
+	account_device_lock(device, entry, start);
+}
+
+void bme280_unlock_device(struct bme280 *device)
+{
+	u64 hold = ktime_get_ns() - device->locked;
+
+	/** Removed device may be freed once unlocked, so account it before */
+	bme280_lock_stats_hold(&device->stats->locks[device->locked_entry],
+			       hold);
+	trace_bme280_device_lock_release(device, hold);
+
+	mutex_unlock(&device->lock);
+}
+
+ssize_t bme280_lock_selected_device(struct bme280 **device,
+				    enum bme280_entry entry)
+{
+	/**
+	 * Registry keeps its reference until readers which could see the
+	 * device have left RCU read-side critical sections
+	 */
+	rcu_read_lock();
+
+	*device = rcu_dereference(bme280_device);
+	if (*device != NULL) {
+		bme280_get_device(*device);
+	}
+
+	rcu_read_unlock();
+
+	if (*device == NULL) {
+		pr_warn(THIS_MODULE_NAME
+			": current device not specified, use"
+			" /sys/class/" THIS_MODULE_NAME "/i2c to specify\n");
+
+		return -ENODEV;
+	}
+
+	bme280_lock_device(*device, entry);
+
+	/** Device could be unregistered while waiting for its lock */
+	if ((*device)->removed) {
+		bme280_unlock_selected_device(*device);
+		*device = NULL;
+
+		return -ENODEV;
+	}
+
+	return BME280_OK;
+}
+
+void bme280_unlock_selected_device(struct bme280 *device)
+{
+	if (device == NULL) {
+		return;
+	}
+
+	bme280_unlock_device(device);
+	bme280_put_device(device);
+}
 
 static ssize_t bme280_i2c_register_device(struct i2c_client *client)
 {
@@ -32,6 +204,22 @@ static ssize_t bme280_i2c_register_device(struct i2c_client *client)
 		goto err;
 	}
 
+	/** Histograms of all entry points take ~27 KB, vmalloc may back them */
+	device->stats = kvzalloc(sizeof(*device->stats), GFP_KERNEL);
+	if (device->stats == NULL) {
+		pr_err(THIS_MODULE_NAME
+		       ": failed to allocate statistics for device at "
+		       "%s-%d 0x%x\n",
+		       client->adapter->dev.of_node->name, client->adapter->nr,
+		       client->addr);
+
+		ret = -ENOMEM;
+		goto cleanup_device;
+	}
+
+	mutex_init(&device->lock);
+	kref_init(&device->refs);
+
 	ret = bme280_init(device, client);
 	if (ret != BME280_OK) {
 		pr_err(THIS_MODULE_NAME
@@ -39,7 +227,7 @@ static ssize_t bme280_i2c_register_device(struct i2c_client *client)
 		       client->adapter->dev.of_node->name, client->adapter->nr,
 		       client->addr);
 
-		goto cleanup_device;
+		goto free_stats;
 	}
 
 	/** Default settings for new device */
@@ -48,6 +236,10 @@ static ssize_t bme280_i2c_register_device(struct i2c_client *client)
 	device->settings.osrs_h = BME280_INDOOR_HUM_OVERSAMPLING;
 	device->settings.filter = BME280_INDOOR_FILTER_COEFF;
 	device->settings.standby_time = BME280_INDOOR_STANDBY_TIME;
+	device->calib_data.context.press_precision =
+		pressure_precision == BME280_PRESS_PRECISION_64 ?
+			BME280_PRESS_PRECISION_64 :
+			BME280_PRESS_PRECISION_32;
 
 	ret = bme280_set_sensor_settings(device, BME280_ALL_SETTINGS_SEL);
 	if (ret != BME280_OK) {
@@ -56,10 +248,30 @@ static ssize_t bme280_i2c_register_device(struct i2c_client *client)
 		       client->adapter->dev.of_node->name, client->adapter->nr,
 		       client->addr);
 
-		goto cleanup_device;
+		goto deinit_device;
 	}
 
-	mutex_lock(&bme280_devices_lock);
+	ret = bme280_init_sampler(device);
+	if (ret) {
+		goto deinit_device;
+	}
+
+	ret = bme280_start_sampler(device);
+	if (ret != BME280_OK) {
+		pr_err(THIS_MODULE_NAME
+		       ": failed to start sampling device at %s-%d 0x%x\n",
+		       client->adapter->dev.of_node->name, client->adapter->nr,
+		       client->addr);
+
+		goto deinit_sampler;
+	}
+
+	ret = bme280_attach_iio_mapp(device);
+	if (ret) {
+		goto cancel_sampler;
+	}
+
+	bme280_lock_devices(BME280_ENTRY_probe);
 
 	if (list_empty(&bme280_devices)) {
 		ret = bme280_create_regs_mapp();
@@ -71,20 +283,47 @@ static ssize_t bme280_i2c_register_device(struct i2c_client *client)
 		if (ret) {
 			goto unlock_devices;
 		}
+
+		ret = bme280_create_dev_mapp();
+		if (ret) {
+			goto unlock_devices;
+		}
+
+		ret = bme280_create_ctl_mapp();
+		if (ret) {
+			goto unlock_devices;
+		}
+
+		bme280_create_debug_mapp();
+	}
+
+	ret = bme280_attach_dev_mapp(device);
+	if (ret) {
+		goto unlock_devices;
 	}
 
-	list_add(&device->registered, &bme280_devices);
+	list_add_rcu(&device->registered, &bme280_devices);
+	bme280_attach_debug_mapp(device);
 
 	if (list_is_singular(&bme280_devices)) {
-		bme280_device = device;
+		rcu_assign_pointer(bme280_device, device);
 	}
 
-	mutex_unlock(&bme280_devices_lock);
+	bme280_unlock_devices();
 
 	return 0;
 
 unlock_devices:
-	mutex_unlock(&bme280_devices_lock);
+	bme280_unlock_devices();
+	bme280_detach_iio_mapp(device);
+cancel_sampler:
+	bme280_cancel_sampler(device);
+deinit_sampler:
+	bme280_deinit_sampler(device);
+deinit_device:
+	bme280_deinit(device);
+free_stats:
+	kvfree(device->stats);
 cleanup_device:
 	kfree(device);
 err:
@@ -98,9 +337,17 @@ static ssize_t bme280_i2c_unregister_device(struct i2c_client *client)
 	struct list_head *iter = NULL;
 	struct bme280 *device = NULL;
 
-	u8 contains;
+	u8 contains = 0;
 
-	mutex_lock(&bme280_devices_lock);
+	/**
+	 * Debugfs and sysfs wait for active readers on removal, readers take
+	 * lock of the device, so device mappings are removed before locking
+	 */
+	bme280_detach_debug_mapp(i2c_get_clientdata(client));
+	bme280_detach_dev_mapp(i2c_get_clientdata(client));
+	bme280_detach_iio_mapp(i2c_get_clientdata(client));
+
+	bme280_lock_devices(BME280_ENTRY_remove);
 
 	list_for_each (iter, &bme280_devices) {
 		device = list_entry(iter, struct bme280, registered);
@@ -111,12 +358,11 @@ static ssize_t bme280_i2c_unregister_device(struct i2c_client *client)
 	}
 
 	if (contains) {
-		if (device == bme280_device) {
-			bme280_device = NULL;
+		if (device == rcu_access_pointer(bme280_device)) {
+			RCU_INIT_POINTER(bme280_device, NULL);
 		}
 
-		list_del(iter);
-		kfree(device);
+		list_del_rcu(iter);
 	} else {
 		pr_err(THIS_MODULE_NAME
 		       ": couldn't found device for deinitialization,"
@@ -129,17 +375,38 @@ static ssize_t bme280_i2c_unregister_device(struct i2c_client *client)
 	}
 
 	if (!list_empty(&bme280_devices)) {
-		bme280_device = list_first_entry(&bme280_devices, struct bme280,
-						 registered);
+		rcu_assign_pointer(bme280_device,
+				   list_first_entry(&bme280_devices,
+						    struct bme280, registered));
 	} else {
 		bme280_remove_regs_mapp();
 		bme280_remove_info_mapp();
+		bme280_remove_dev_mapp();
+		bme280_remove_ctl_mapp();
+		bme280_remove_debug_mapp();
 	}
 
 	ret = 0;
 
 err:
-	mutex_unlock(&bme280_devices_lock);
+	bme280_unlock_devices();
+
+	/**
+	 * Lock-free readers could still see the device or its I2C client,
+	 * which is freed after removal, so wait for them before going on.
+	 * Device is freed when the last reference is dropped
+	 */
+	if (contains) {
+		synchronize_rcu();
+
+		bme280_lock_device(device, BME280_ENTRY_remove);
+		device->removed = true;
+		device->sampling = false;
+		bme280_unlock_device(device);
+
+		bme280_cancel_sampler(device);
+		bme280_put_device(device);
+	}
 
 	return ret;
 }
@@ -0,0 +1,444 @@
+/**
+ * @brief Microbenchmark of compensation formulas of the BME280 driver. The
+ * driver's formulas are extracted from src/bme280.c by tools/Makefile, so the
+ * benchmark always runs the code of the tree. They are checked to be
+ * bit-identical to the datasheet formulas, which recompute calibration
+ * products on every sample, and both are timed in CPU cycles. The 32-bit and
+ * 64-bit pressure formulas are compared by accuracy and by time
+ *
+ * Cycles are counted by perf events, which are available on x86 and on ARMv7
+ * with a PMU. Without them nanoseconds of the monotonic clock are reported
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint8_t u8;
+typedef int8_t s8;
+typedef uint16_t u16;
+typedef int16_t s16;
+typedef uint32_t u32;
+typedef int32_t s32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+#define div64_s64(dividend, divisor) ((dividend) / (divisor))
+#define clamp_t(type, val, lo, hi)                                             \
+	((type)(val) < (type)(lo) ?                                            \
+		 (type)(lo) :                                                  \
+		 (type)(val) > (type)(hi) ? (type)(hi) : (type)(val))
+
+/** Generated from include/bme280.h and src/bme280.c */
+#include "bme280_comp.h"
+
+#define SAMPLES 1024
+#define ROUNDS 10000
+
+/************************* Datasheet Formulas *********************************/
+
+static u32 datasheet_pressure(const struct bme280_uncomp_data *uncomp_data,
+			      const struct bme280_calib_data *calib_data,
+			      s32 t_fine)
+{
+	s32 var1;
+	s32 var2;
+	s32 var3;
+	s32 var4;
+	u32 var5;
+	u32 pressure;
+
+	var1 = (t_fine / 2) - (s32)64000;
+	var2 = (((var1 / 4) * (var1 / 4)) / 2048) * ((s32)calib_data->dig_P6);
+	var2 = var2 + ((var1 * ((s32)calib_data->dig_P5)) * 2);
+	var2 = (var2 / 4) + (((s32)calib_data->dig_P4) * 65536);
+	var3 = (calib_data->dig_P3 * (((var1 / 4) * (var1 / 4)) / 8192)) / 8;
+	var4 = (((s32)calib_data->dig_P2) * var1) / 2;
+	var1 = (var3 + var4) / 262144;
+	var1 = (((32768 + var1)) * ((s32)calib_data->dig_P1)) / 32768;
+
+	if (var1) {
+		var5 = (u32)((u32)1048576) - uncomp_data->pressure;
+		pressure = ((u32)(var5 - (u32)(var2 / 4096))) * 3125;
+		if (pressure < 0x80000000) {
+			pressure = (pressure << 1) / ((u32)var1);
+		} else {
+			pressure = (pressure / (u32)var1) * 2;
+		}
+
+		var1 = (((s32)calib_data->dig_P9) *
+			((s32)(((pressure / 8) * (pressure / 8)) / 8192))) /
+		       4096;
+		var2 = (((s32)(pressure / 4)) * ((s32)calib_data->dig_P8)) /
+		       8192;
+
+		pressure = (u32)((s32)pressure +
+				 ((var1 + var2 + calib_data->dig_P7) / 16));
+
+		if (pressure < BME280_PRESS_MIN) {
+			pressure = BME280_PRESS_MIN;
+		} else if (pressure > BME280_PRESS_MAX) {
+			pressure = BME280_PRESS_MAX;
+		}
+	} else {
+		pressure = BME280_PRESS_MIN;
+	}
+
+	return pressure;
+}
+
+static s32 datasheet_temperature(const struct bme280_uncomp_data *uncomp_data,
+				 const struct bme280_calib_data *calib_data,
+				 s32 *t_fine)
+{
+	s32 var1;
+	s32 var2;
+	s32 temperature;
+
+	var1 = (s32)((uncomp_data->temperature / 8) -
+		     ((s32)calib_data->dig_T1 * 2));
+	var1 = (var1 * ((s32)calib_data->dig_T2)) / 2048;
+	var2 = (s32)((uncomp_data->temperature / 16) -
+		     ((s32)calib_data->dig_T1));
+	var2 = (((var2 * var2) / 4096) * ((s32)calib_data->dig_T3)) / 16384;
+
+	*t_fine = var1 + var2;
+	temperature = (*t_fine * 5 + 128) / 256;
+
+	if (temperature < BME280_TEMP_MIN) {
+		temperature = BME280_TEMP_MIN;
+	} else if (temperature > BME280_TEMP_MAX) {
+		temperature = BME280_TEMP_MAX;
+	}
+
+	return temperature;
+}
+
+static u32 datasheet_humidity(const struct bme280_uncomp_data *uncomp_data,
+			      const struct bme280_calib_data *calib_data,
+			      s32 t_fine)
+{
+	s32 var1;
+	s32 var2;
+	s32 var3;
+	s32 var4;
+	s32 var5;
+	u32 humidity;
+
+	var1 = t_fine - ((s32)76800);
+	var2 = (s32)(uncomp_data->humidity * 16384);
+	var3 = (s32)(((s32)calib_data->dig_H4) * 1048576);
+	var4 = ((s32)calib_data->dig_H5) * var1;
+	var5 = (((var2 - var3) - var4) + (s32)16384) / 32768;
+	var2 = (var1 * ((s32)calib_data->dig_H6)) / 1024;
+	var3 = (var1 * ((s32)calib_data->dig_H3)) / 2048;
+	var4 = ((var2 * (var3 + (s32)32768)) / 1024) + (s32)2097152;
+	var2 = ((var4 * ((s32)calib_data->dig_H2)) + 8192) / 16384;
+	var3 = var5 * var2;
+	var4 = ((var3 / 32768) * (var3 / 32768)) / 128;
+	var5 = var3 - ((var4 * ((s32)calib_data->dig_H1)) / 16);
+	var5 = (var5 < 0 ? 0 : var5);
+	var5 = (var5 > 419430400 ? 419430400 : var5);
+
+	humidity = (u32)(var5 / 4096);
+
+	if (humidity > BME280_HUM_MAX) {
+		humidity = BME280_HUM_MAX;
+	}
+
+	return humidity;
+}
+
+/***************************** Common Functions *******************************/
+
+static int cycles_fd = -1;
+
+static void open_cycles(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	cycles_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/** CPU cycles if perf events are available, nanoseconds otherwise */
+static u64 read_counter(void)
+{
+	struct timespec ts;
+	u64 cycles;
+
+	if ((cycles_fd >= 0) &&
+	    (read(cycles_fd, &cycles, sizeof(cycles)) == sizeof(cycles))) {
+		return cycles;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static u32 random_u32(void)
+{
+	return ((u32)rand() << 16) ^ (u32)rand();
+}
+
+/** Calibration data of a real sensor */
+static void typical_calib_data(struct bme280_calib_data *calib_data)
+{
+	memset(calib_data, 0, sizeof(*calib_data));
+	calib_data->dig_T1 = 27504;
+	calib_data->dig_T2 = 26435;
+	calib_data->dig_T3 = -1000;
+	calib_data->dig_P1 = 36477;
+	calib_data->dig_P2 = -10685;
+	calib_data->dig_P3 = 3024;
+	calib_data->dig_P4 = 2855;
+	calib_data->dig_P5 = 140;
+	calib_data->dig_P6 = -7;
+	calib_data->dig_P7 = 15500;
+	calib_data->dig_P8 = -14600;
+	calib_data->dig_P9 = 6000;
+	calib_data->dig_H1 = 75;
+	calib_data->dig_H2 = 362;
+	calib_data->dig_H3 = 0;
+	calib_data->dig_H4 = 313;
+	calib_data->dig_H5 = 50;
+	calib_data->dig_H6 = 30;
+	init_comp_context(calib_data);
+}
+
+/** Any register contents, dig_H4 and dig_H5 are 12-bit */
+static void random_calib_data(struct bme280_calib_data *calib_data)
+{
+	memset(calib_data, 0, sizeof(*calib_data));
+	calib_data->dig_T1 = random_u32();
+	calib_data->dig_T2 = random_u32();
+	calib_data->dig_T3 = random_u32();
+	calib_data->dig_P1 = random_u32();
+	calib_data->dig_P2 = random_u32();
+	calib_data->dig_P3 = random_u32();
+	calib_data->dig_P4 = random_u32();
+	calib_data->dig_P5 = random_u32();
+	calib_data->dig_P6 = random_u32();
+	calib_data->dig_P7 = random_u32();
+	calib_data->dig_P8 = random_u32();
+	calib_data->dig_P9 = random_u32();
+	calib_data->dig_H1 = random_u32();
+	calib_data->dig_H2 = random_u32();
+	calib_data->dig_H3 = random_u32();
+	calib_data->dig_H4 = (s16)(random_u32() % 4096) - 2048;
+	calib_data->dig_H5 = (s16)(random_u32() % 4096) - 2048;
+	calib_data->dig_H6 = random_u32();
+	init_comp_context(calib_data);
+}
+
+/*************************** Checks and Benchmarks ****************************/
+
+/** Counts inputs for which the driver differs from the datasheet */
+static unsigned long check(unsigned long count)
+{
+	struct bme280_calib_data calib_data;
+	struct bme280_uncomp_data uncomp_data;
+	unsigned long mismatches = 0;
+	unsigned long i;
+	s32 t_fine[2];
+
+	for (i = 0; i < count; i++) {
+		if (i & 1) {
+			typical_calib_data(&calib_data);
+		} else {
+			random_calib_data(&calib_data);
+		}
+
+		uncomp_data.pressure = random_u32() & 0xFFFFF;
+		uncomp_data.temperature = random_u32() & 0xFFFFF;
+		uncomp_data.humidity = random_u32() & 0xFFFF;
+
+		if ((compensate_temperature(&uncomp_data, &calib_data,
+					    &t_fine[0]) !=
+		     datasheet_temperature(&uncomp_data, &calib_data,
+					   &t_fine[1])) ||
+		    (t_fine[0] != t_fine[1]) ||
+		    (compensate_pressure(&uncomp_data, &calib_data,
+					 t_fine[0]) !=
+		     datasheet_pressure(&uncomp_data, &calib_data,
+					t_fine[0])) ||
+		    (compensate_humidity(&uncomp_data, &calib_data,
+					 t_fine[0]) !=
+		     datasheet_humidity(&uncomp_data, &calib_data,
+					t_fine[0]))) {
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+/**
+ * Largest difference of the 32-bit formula from the 64-bit one rounded to
+ * whole Pa, over raw data of the calibrated range
+ */
+static u32 compare_precision(unsigned long count)
+{
+	struct bme280_calib_data calib_data;
+	struct bme280_uncomp_data uncomp_data;
+	unsigned long i;
+	u32 pressure;
+	u32 pressure_fine;
+	u32 diff;
+	u32 max = 0;
+	s32 t_fine;
+
+	typical_calib_data(&calib_data);
+
+	for (i = 0; i < count; i++) {
+		uncomp_data.pressure = 300000 + random_u32() % 200000;
+		uncomp_data.temperature = 450000 + random_u32() % 150000;
+
+		compensate_temperature(&uncomp_data, &calib_data, &t_fine);
+		pressure = compensate_pressure(&uncomp_data, &calib_data,
+					       t_fine);
+		pressure_fine = compensate_pressure_64(&uncomp_data,
+						       &calib_data, t_fine);
+
+		pressure_fine = (pressure_fine + PRESS_FINE_SCALE / 2) /
+				PRESS_FINE_SCALE;
+		diff = pressure > pressure_fine ? pressure - pressure_fine :
+						  pressure_fine - pressure;
+		if (diff > max) {
+			max = diff;
+		}
+	}
+
+	return max;
+}
+
+static void random_samples(struct bme280_uncomp_data *samples)
+{
+	size_t i;
+
+	/** Raw data around 20 °C, 1000 hPa and 40 % */
+	for (i = 0; i < SAMPLES; i++) {
+		samples[i].pressure = 415148 + random_u32() % 4096;
+		samples[i].temperature = 519888 + random_u32() % 4096;
+		samples[i].humidity = 30000 + random_u32() % 4096;
+	}
+}
+
+/**
+ * Formulas are called through pointers, so they are not inlined into the loop
+ * and calibration products are not hoisted out of it, as in the driver.
+ * Humidity is skipped if its formula is not set
+ */
+struct formulas {
+	s32 (*temperature)(const struct bme280_uncomp_data *uncomp_data,
+			   const struct bme280_calib_data *calib_data,
+			   s32 *t_fine);
+	u32 (*pressure)(const struct bme280_uncomp_data *uncomp_data,
+			const struct bme280_calib_data *calib_data, s32 t_fine);
+	u32 (*humidity)(const struct bme280_uncomp_data *uncomp_data,
+			const struct bme280_calib_data *calib_data, s32 t_fine);
+};
+
+static const struct formulas datasheet = { &datasheet_temperature,
+					   &datasheet_pressure,
+					   &datasheet_humidity };
+
+static const struct formulas driver = { &compensate_temperature,
+					&compensate_pressure,
+					&compensate_humidity };
+
+/** Temperature is needed for t_fine of pressure */
+static const struct formulas pressure_32 = { &compensate_temperature,
+					     &compensate_pressure, NULL };
+
+static const struct formulas pressure_64 = { &compensate_temperature,
+					     &compensate_pressure_64, NULL };
+
+/** Counter units per sample of all formulas */
+static double bench(const struct bme280_uncomp_data *samples,
+		    const struct bme280_calib_data *calib_data,
+		    const struct formulas *volatile formulas)
+{
+	volatile u32 sink = 0;
+	u64 start;
+	s32 t_fine;
+	size_t i;
+	int r;
+
+	start = read_counter();
+
+	for (r = 0; r < ROUNDS; r++) {
+		for (i = 0; i < SAMPLES; i++) {
+			sink += formulas->temperature(&samples[i], calib_data,
+						      &t_fine);
+			sink += formulas->pressure(&samples[i], calib_data,
+						   t_fine);
+			if (formulas->humidity != NULL) {
+				sink += formulas->humidity(&samples[i],
+							   calib_data, t_fine);
+			}
+		}
+	}
+
+	return (double)(read_counter() - start) / ((double)ROUNDS * SAMPLES);
+}
+
+/***************************** Main Function *********************************/
+
+int main(int argc, char **argv)
+{
+	struct bme280_uncomp_data samples[SAMPLES];
+	struct bme280_calib_data calib_data;
+	unsigned long count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned long mismatches;
+	const char *unit;
+
+	srand(1);
+
+	mismatches = check(count);
+	printf("driver vs datasheet: %lu mismatches of %lu inputs\n",
+	       mismatches, count);
+
+	open_cycles();
+	unit = cycles_fd >= 0 ? "cycles" : "ns";
+
+	typical_calib_data(&calib_data);
+	random_samples(samples);
+
+	/** Every variant runs twice, the first run warms up caches */
+	bench(samples, &calib_data, &datasheet);
+	printf("datasheet:           %6.1f %s/sample\n",
+	       bench(samples, &calib_data, &datasheet), unit);
+	bench(samples, &calib_data, &driver);
+	printf("driver:              %6.1f %s/sample\n",
+	       bench(samples, &calib_data, &driver), unit);
+
+	printf("\n32-bit vs 64-bit pressure: %u Pa at most\n",
+	       compare_precision(count));
+	bench(samples, &calib_data, &pressure_32);
+	printf("temperature + 32-bit pressure: %6.1f %s/sample\n",
+	       bench(samples, &calib_data, &pressure_32), unit);
+	bench(samples, &calib_data, &pressure_64);
+	printf("temperature + 64-bit pressure: %6.1f %s/sample\n",
+	       bench(samples, &calib_data, &pressure_64), unit);
+
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,431 @@
+/**
+ * @brief Load generator for the BME280 driver. Reads pressure of devices
+ * through their IIO channels from many threads and reports aggregate samples
+ * per second while the number of loaded I2C adapters grows from one to all of
+ * them
+ *
+ * Devices should be in sleep or forced mode, so every read is a forced
+ * conversion. In normal mode reads return the latest sample of the sampler
+ * and measure the driver only
+ *
+ * @author Eduard Malokhvii <malokhvii.ee@gmail.com>
+ * @version 1.0
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <bme280_uapi.h>
+
+#define IIO_DEVICES "/sys/bus/iio/devices"
+#define IIO_NAME "bme280"
+#define CTL_DEVICE "/dev/bme280"
+
+#define MAX_DEVICES 64
+
+struct device {
+	char name[64]; /**< Directory of the device in IIO devices */
+	unsigned int adapter; /**< I2C adapter number */
+	unsigned int address; /**< I2C address */
+};
+
+struct worker {
+	pthread_t thread;
+	const struct device *devices; /**< Devices read by the worker */
+	size_t count; /**< Number of devices, more than one for batch reads */
+	uint64_t samples; /**< Number of successfully read samples */
+	uint64_t errors; /**< Number of failed reads */
+};
+
+static struct device devices[MAX_DEVICES];
+static size_t devices_count;
+
+static unsigned int duration = 5;
+static unsigned int threads = 1;
+static int batch;
+
+static volatile int running;
+
+/***************************** Common Functions *******************************/
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_devices(const void *a, const void *b)
+{
+	const struct device *x = a;
+	const struct device *y = b;
+
+	if (x->adapter != y->adapter) {
+		return x->adapter < y->adapter ? -1 : 1;
+	}
+
+	return x->address < y->address ? -1 : (x->address > y->address);
+}
+
+/** Devices are sorted by adapter */
+static int is_first_of_adapter(size_t i)
+{
+	return (i == 0) || (devices[i].adapter != devices[i - 1].adapter);
+}
+
+/** Reads the first line of a file of the IIO device */
+static int read_attr(const char *name, const char *attr, char *buf,
+		     size_t size)
+{
+	char path[128];
+	FILE *file;
+	int ret = -1;
+
+	snprintf(path, sizeof(path), IIO_DEVICES "/%s/%s", name, attr);
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+
+	if (fgets(buf, size, file) != NULL) {
+		buf[strcspn(buf, "\n")] = '\0';
+		ret = 0;
+	}
+
+	fclose(file);
+
+	return ret;
+}
+
+/** Parent of the IIO device is the I2C client, e.g. 1-0076 */
+static int add_device(const char *name)
+{
+	struct device *device;
+	char path[128];
+	char link[128];
+	char buf[32];
+	ssize_t len;
+
+	if (devices_count == MAX_DEVICES) {
+		fprintf(stderr, "too many devices, %s is ignored\n", name);
+		return -1;
+	}
+
+	if ((read_attr(name, "name", buf, sizeof(buf)) != 0) ||
+	    (strcmp(buf, IIO_NAME) != 0)) {
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), IIO_DEVICES "/%s/device", name);
+	len = readlink(path, link, sizeof(link) - 1);
+	if (len < 0) {
+		perror(path);
+		return -1;
+	}
+
+	link[len] = '\0';
+
+	device = &devices[devices_count];
+	if (sscanf(basename(link), "%u-%x", &device->adapter,
+		   &device->address) != 2) {
+		fprintf(stderr, "%s is not an I2C device\n", name);
+		return -1;
+	}
+
+	snprintf(device->name, sizeof(device->name), "%s", name);
+	devices_count++;
+
+	return 0;
+}
+
+static int find_devices(void)
+{
+	struct dirent *entry;
+	DIR *dir;
+
+	dir = opendir(IIO_DEVICES);
+	if (dir == NULL) {
+		perror(IIO_DEVICES);
+		return -1;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "iio:device", 10) == 0) {
+			add_device(entry->d_name);
+		}
+	}
+
+	closedir(dir);
+
+	return 0;
+}
+
+/******************************* Workers **************************************/
+
+/** Every read of the channel is a request of a single device */
+static void *iio_worker(void *arg)
+{
+	struct worker *worker = arg;
+	char path[128];
+	char buf[32];
+	int fd;
+
+	snprintf(path, sizeof(path), IIO_DEVICES "/%s/in_pressure_raw",
+		 worker->devices->name);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	while (running) {
+		if (pread(fd, buf, sizeof(buf), 0) > 0) {
+			worker->samples++;
+		} else {
+			worker->errors++;
+		}
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+/** Every ioctl reads all devices of the worker by a single call */
+static void *batch_worker(void *arg)
+{
+	struct worker *worker = arg;
+	struct bme280_batch_record records[MAX_DEVICES];
+	struct bme280_batch request;
+	size_t i;
+	int fd;
+
+	fd = open(CTL_DEVICE, O_RDONLY);
+	if (fd < 0) {
+		perror(CTL_DEVICE);
+		return NULL;
+	}
+
+	while (running) {
+		memset(records, 0, sizeof(records));
+		for (i = 0; i < worker->count; i++) {
+			records[i].adapter = worker->devices[i].adapter;
+			records[i].address = worker->devices[i].address;
+		}
+
+		memset(&request, 0, sizeof(request));
+		request.channels = BME280_BATCH_ALL_CHANNELS;
+		request.count = worker->count;
+		request.records = (uintptr_t)records;
+
+		if (ioctl(fd, BME280_IOC_BATCH_READ, &request) < 0) {
+			worker->errors += worker->count;
+			continue;
+		}
+
+		for (i = 0; i < request.count; i++) {
+			if (records[i].error == 0) {
+				worker->samples++;
+			} else {
+				worker->errors++;
+			}
+		}
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+/**
+ * Loads devices of the given number of adapters for the duration and prints
+ * samples per second of every adapter and of all of them
+ */
+static int run(unsigned int adapters)
+{
+	struct worker *workers;
+	size_t loaded = 0;
+	size_t count = 0;
+	size_t i;
+	size_t j;
+	size_t t;
+	unsigned int seen = 0;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t samples = 0;
+	uint64_t errors = 0;
+	uint64_t adapter_samples;
+	double seconds;
+
+	/** Devices are sorted by adapter, take the first adapters */
+	for (i = 0; i < devices_count; i++) {
+		if (is_first_of_adapter(i)) {
+			if (seen++ == adapters) {
+				break;
+			}
+		}
+
+		loaded++;
+	}
+
+	workers = calloc(loaded * threads, sizeof(*workers));
+	if (workers == NULL) {
+		return -ENOMEM;
+	}
+
+	running = 1;
+
+	for (j = 0; j < threads; j++) {
+		if (batch) {
+			workers[count].devices = devices;
+			workers[count].count = loaded;
+			pthread_create(&workers[count].thread, NULL,
+				       &batch_worker, &workers[count]);
+			count++;
+			continue;
+		}
+
+		for (i = 0; i < loaded; i++) {
+			workers[count].devices = &devices[i];
+			workers[count].count = 1;
+			pthread_create(&workers[count].thread, NULL,
+				       &iio_worker, &workers[count]);
+			count++;
+		}
+	}
+
+	start = now_ns();
+	sleep(duration);
+	running = 0;
+
+	for (i = 0; i < count; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	elapsed = now_ns() - start;
+	seconds = (double)elapsed / 1e9;
+
+	printf("adapters %u, devices %zu, threads %zu\n", adapters, loaded,
+	       count);
+
+	/**
+	 * Batch workers read all adapters at once, only the total is known.
+	 * Worker of device k of thread t is at t * loaded + k
+	 */
+	for (i = 0; !batch && (i < loaded); i = j) {
+		adapter_samples = 0;
+		for (j = i; (j < loaded) &&
+			    (devices[j].adapter == devices[i].adapter);
+		     j++) {
+			for (t = 0; t < threads; t++) {
+				adapter_samples +=
+					workers[t * loaded + j].samples;
+			}
+		}
+
+		printf("  i2c-%-3u %10.1f samples/s\n", devices[i].adapter,
+		       (double)adapter_samples / seconds);
+	}
+
+	for (i = 0; i < count; i++) {
+		samples += workers[i].samples;
+		errors += workers[i].errors;
+	}
+
+	printf("  total   %10.1f samples/s, %llu errors\n",
+	       (double)samples / seconds, (unsigned long long)errors);
+
+	free(workers);
+
+	return 0;
+}
+
+/***************************** Main Function *********************************/
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-t seconds] [-j threads] [-b] [device...]\n"
+		"  -t  duration of every step, default 5 seconds\n"
+		"  -j  threads per device, or batch threads with -b\n"
+		"  -b  read devices by BME280_IOC_BATCH_READ on " CTL_DEVICE
+		"\n"
+		"  device  directory in " IIO_DEVICES
+		", e.g. iio:device0, all by default\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int adapters = 0;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:j:bh")) != -1) {
+		switch (opt) {
+		case 't':
+			duration = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if ((duration == 0) || (threads == 0)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = optind; i < (size_t)argc; i++) {
+		add_device(argv[i]);
+	}
+
+	if ((optind == argc) && (find_devices() != 0)) {
+		return EXIT_FAILURE;
+	}
+
+	if (devices_count == 0) {
+		fprintf(stderr, "no devices found\n");
+		return EXIT_FAILURE;
+	}
+
+	qsort(devices, devices_count, sizeof(*devices), &compare_devices);
+
+	for (i = 0; i < devices_count; i++) {
+		if (is_first_of_adapter(i)) {
+			adapters++;
+		}
+	}
+
+	/** Aggregate rate should grow with every adapter added to the load */
+	for (i = 1; i <= adapters; i++) {
+		if (run(i) != 0) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Checks that a read after a soft reset starts a fresh forced conversion
+# instead of collecting data registers which the reset brought back to their
+# reset values. Pipelining keeps a conversion in flight after every read, so
+# the read after the reset must trigger two conversions: its own one and the
+# pipelined next one.
+#
+# Usage: check_reset.sh <adapter> <address in hex>, e.g. check_reset.sh 1 76
+# Needs root and debugfs mounted at /sys/kernel/debug
+
+set -eu
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 <adapter> <address in hex>" >&2
+	exit 2
+fi
+
+SYS=/sys/class/bme280/bme280-$1-$2
+DEBUG=/sys/kernel/debug/bme280/$(printf '%d-%04x' "$1" "0x$2")
+
+forced_conversions() {
+	sed -n 's/^Forced Conversions *: //p' "$DEBUG/stats"
+}
+
+PIPELINE=$(cat "$SYS/pipeline")
+MODE=$(cat "$SYS/mode")
+trap 'echo "$PIPELINE" > "$SYS/pipeline"; echo "$MODE" > "$SYS/mode"' EXIT
+
+echo 0x00 > "$SYS/mode"
+echo 0x01 > "$SYS/osrs_p"
+echo 0x01 > "$SYS/osrs_t"
+echo 0x01 > "$SYS/osrs_h"
+echo 10000 > "$SYS/pipeline"
+
+cat "$SYS/pressure" > /dev/null
+before=$(forced_conversions)
+
+echo 0xb6 > "$SYS/reset"
+cat "$SYS/pressure" > /dev/null
+after=$(forced_conversions)
+
+if [ $((after - before)) -ne 2 ]; then
+	echo "FAIL: $((after - before)) forced conversions after reset," \
+	     "expected 2" >&2
+	exit 1
+fi
+
+echo "OK: read after reset triggered a fresh conversion"